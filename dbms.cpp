@@ -7,12 +7,41 @@
 #include <algorithm> 
 #include <limits> 
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
 #include <thread>  
 #include <tuple>
 #include <functional>
 #include <map> 
 #include <numeric> 
-#include <regex>  
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <charconv>
+#include <string_view>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <array>
+#include <chrono>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Custom hash function for tuples
 struct TupleHasher {
@@ -41,60 +70,4531 @@ struct OrderBy {
     bool ascending;     // true = ASC, false = DESC
 };
 
+// One aggregate of a grouped query: function is SUM, AVG (or AVERAGE),
+// MIN, MAX or COUNT
+struct Aggregate {
+    std::string column;
+    std::string function;
+};
+
 struct ConditionGroup {
     std::vector<Condition> conditions;
     std::string logicalOp;  // "AND" or "OR" applied within this group
     std::vector<ConditionGroup> subgroups;
 };
 
-struct Index {
-    std::string column;
-    std::unordered_map<std::string, std::vector<size_t>> indexMap;
-};
+// Ordered index from key to row position. Entries are (key, row) pairs kept
+// sorted in fixed-capacity nodes, and leaves are chained both ways so range
+// scans and ordered iteration walk the leaves without revisiting the tree.
+// Erase does not merge underfull leaves; once as many entries have been
+// erased as remain, the tree is rebuilt compactly instead.
+template <typename Key>
+class BPlusTree {
+public:
+    struct Entry {
+        Key key;
+        size_t row;
+
+        bool operator<(const Entry& other) const {
+            if (key < other.key) return true;
+            if (other.key < key) return false;
+            return row < other.row;
+        }
+    };
+
+    BPlusTree() { clear(); }
+
+    size_t size() const { return count; }
+
+    void clear() {
+        root = std::make_unique<Node>();
+        count = 0;
+        erasedSinceBuild = 0;
+    }
+
+    void insert(const Key& key, size_t row) {
+        Split split = insertInto(root.get(), Entry{key, row});
+        if (split.right) {
+            auto newRoot = std::make_unique<Node>();
+            newRoot->leaf = false;
+            newRoot->entries.push_back(std::move(split.separator));
+            newRoot->children.push_back(std::move(root));
+            newRoot->children.push_back(std::move(split.right));
+            root = std::move(newRoot);
+        }
+        ++count;
+    }
+
+    bool erase(const Key& key, size_t row) {
+        Entry entry{key, row};
+        Node* leaf = findLeaf(entry);
+        auto it = std::lower_bound(leaf->entries.begin(), leaf->entries.end(), entry);
+        if (it == leaf->entries.end() || entry < *it) return false;
+        leaf->entries.erase(it);
+        --count;
+        if (++erasedSinceBuild > count + NODE_CAPACITY) {
+            std::vector<Entry> remaining;
+            forEach(true, [&](const Entry& e) { remaining.push_back(e); });
+            build(std::move(remaining));
+        }
+        return true;
+    }
+
+    // Insert many entries at once. A batch that is a sizable share of the
+    // tree is merged with the existing entries and the tree rebuilt packed;
+    // a smaller one is sorted and inserted in key order, so consecutive
+    // inserts land in the same or neighbouring leaves.
+    void insertBatch(std::vector<Entry> entries) {
+        std::sort(entries.begin(), entries.end());
+        if (entries.size() * 8 < count) {
+            for (auto& entry : entries) insert(std::move(entry.key), entry.row);
+            return;
+        }
+        std::vector<Entry> merged;
+        merged.reserve(count + entries.size());
+        forEach(true, [&](const Entry& e) { merged.push_back(e); });
+        size_t middle = merged.size();
+        merged.insert(merged.end(), std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+        std::inplace_merge(merged.begin(), merged.begin() + middle, merged.end());
+        build(std::move(merged));
+    }
+
+    // Replace the contents with the given entries, packing the leaves
+    void build(std::vector<Entry> entries) {
+        std::sort(entries.begin(), entries.end());
+        clear();
+        count = entries.size();
+        if (entries.empty()) return;
+
+        // Leaves are filled to 3/4 so that later inserts rarely split at once
+        const size_t fill = NODE_CAPACITY * 3 / 4;
+        std::vector<std::pair<std::unique_ptr<Node>, Entry>> level;   // node and its smallest entry
+        Node* previous = nullptr;
+        for (size_t i = 0; i < entries.size(); i += fill) {
+            auto leaf = std::make_unique<Node>();
+            size_t end = std::min(entries.size(), i + fill);
+            leaf->entries.assign(std::make_move_iterator(entries.begin() + i), std::make_move_iterator(entries.begin() + end));
+            leaf->prev = previous;
+            if (previous) previous->next = leaf.get();
+            previous = leaf.get();
+            Entry smallest = leaf->entries.front();
+            level.emplace_back(std::move(leaf), std::move(smallest));
+        }
+
+        while (level.size() > 1) {
+            std::vector<std::pair<std::unique_ptr<Node>, Entry>> parents;
+            for (size_t i = 0; i < level.size(); i += fill) {
+                auto parent = std::make_unique<Node>();
+                parent->leaf = false;
+                size_t end = std::min(level.size(), i + fill);
+                Entry smallest = level[i].second;
+                for (size_t j = i; j < end; ++j) {
+                    if (j > i) parent->entries.push_back(std::move(level[j].second));
+                    parent->children.push_back(std::move(level[j].first));
+                }
+                parents.emplace_back(std::move(parent), std::move(smallest));
+            }
+            level = std::move(parents);
+        }
+        root = std::move(level.front().first);
+    }
+
+    bool first(Entry& out) const {
+        const Node* leaf = leftmostLeaf();
+        while (leaf && leaf->entries.empty()) leaf = leaf->next;
+        if (!leaf) return false;
+        out = leaf->entries.front();
+        return true;
+    }
+
+    bool last(Entry& out) const {
+        const Node* leaf = rightmostLeaf();
+        while (leaf && leaf->entries.empty()) leaf = leaf->prev;
+        if (!leaf) return false;
+        out = leaf->entries.back();
+        return true;
+    }
+
+    // Call fn for every entry whose key lies between low and high in key
+    // order; a null bound leaves that side open
+    template <typename Fn>
+    void range(const Key* low, bool lowInclusive, const Key* high, bool highInclusive, Fn&& fn) const {
+        const Node* leaf;
+        size_t pos;
+        if (low) {
+            Entry target{*low, 0};
+            leaf = findLeaf(target);
+            pos = std::lower_bound(leaf->entries.begin(), leaf->entries.end(), target) - leaf->entries.begin();
+        } else {
+            leaf = leftmostLeaf();
+            pos = 0;
+        }
+
+        for (; leaf; leaf = leaf->next, pos = 0) {
+            for (; pos < leaf->entries.size(); ++pos) {
+                const Entry& entry = leaf->entries[pos];
+                if (low && !lowInclusive && !(*low < entry.key)) continue;
+                if (high && (highInclusive ? *high < entry.key : !(entry.key < *high))) return;
+                fn(entry);
+            }
+        }
+    }
+
+    template <typename Fn>
+    void forEach(bool ascending, Fn&& fn) const {
+        forEachWhile(ascending, [&](const Entry& entry) {
+            fn(entry);
+            return true;
+        });
+    }
+
+    // forEach that stops as soon as fn returns false
+    template <typename Fn>
+    void forEachWhile(bool ascending, Fn&& fn) const {
+        if (ascending) {
+            for (const Node* leaf = leftmostLeaf(); leaf; leaf = leaf->next) {
+                for (const auto& entry : leaf->entries) {
+                    if (!fn(entry)) return;
+                }
+            }
+        } else {
+            for (const Node* leaf = rightmostLeaf(); leaf; leaf = leaf->prev) {
+                for (auto it = leaf->entries.rbegin(); it != leaf->entries.rend(); ++it) {
+                    if (!fn(*it)) return;
+                }
+            }
+        }
+    }
+
+    // Renumber rows in place. fn must keep rows in the same order (as when
+    // rows are erased and the rest shift down), so no entry moves.
+    template <typename Fn>
+    void relabelRows(Fn&& fn) {
+        relabel(root.get(), fn);
+    }
+
+    // Renumber rows by an arbitrary mapping (e.g. after a sort); entries
+    // with equal keys are re-sorted, so the tree is rebuilt
+    template <typename Fn>
+    void remapRows(Fn&& fn) {
+        std::vector<Entry> entries;
+        entries.reserve(count);
+        forEach(true, [&](const Entry& e) { entries.push_back({e.key, fn(e.row)}); });
+        build(std::move(entries));
+    }
+
+private:
+    static constexpr size_t NODE_CAPACITY = 64;
+
+    struct Node {
+        bool leaf = true;
+        // Leaf: the sorted entries. Internal: separators, where entries[i]
+        // is no greater than anything stored under children[i + 1].
+        std::vector<Entry> entries;
+        std::vector<std::unique_ptr<Node>> children;
+        Node* next = nullptr;
+        Node* prev = nullptr;
+    };
+
+    struct Split {
+        Entry separator;
+        std::unique_ptr<Node> right;
+    };
+
+    std::unique_ptr<Node> root;
+    size_t count = 0;
+    size_t erasedSinceBuild = 0;
+
+    static size_t childFor(const Node* node, const Entry& entry) {
+        return std::upper_bound(node->entries.begin(), node->entries.end(), entry) - node->entries.begin();
+    }
+
+    Node* findLeaf(const Entry& entry) const {
+        Node* node = root.get();
+        while (!node->leaf) node = node->children[childFor(node, entry)].get();
+        return node;
+    }
+
+    // Separators carry row numbers too, so they are renumbered with the leaves
+    template <typename Fn>
+    static void relabel(Node* node, Fn& fn) {
+        for (auto& entry : node->entries) entry.row = fn(entry.row);
+        for (auto& child : node->children) relabel(child.get(), fn);
+    }
+
+    const Node* leftmostLeaf() const {
+        const Node* node = root.get();
+        while (!node->leaf) node = node->children.front().get();
+        return node;
+    }
+
+    const Node* rightmostLeaf() const {
+        const Node* node = root.get();
+        while (!node->leaf) node = node->children.back().get();
+        return node;
+    }
+
+    Split insertInto(Node* node, Entry entry) {
+        if (node->leaf) {
+            auto it = std::upper_bound(node->entries.begin(), node->entries.end(), entry);
+            node->entries.insert(it, std::move(entry));
+            if (node->entries.size() <= NODE_CAPACITY) return {};
+
+            auto right = std::make_unique<Node>();
+            size_t half = node->entries.size() / 2;
+            right->entries.assign(std::make_move_iterator(node->entries.begin() + half), std::make_move_iterator(node->entries.end()));
+            node->entries.resize(half);
+            right->next = node->next;
+            right->prev = node;
+            if (node->next) node->next->prev = right.get();
+            node->next = right.get();
+            Entry separator = right->entries.front();
+            return {std::move(separator), std::move(right)};
+        }
+
+        size_t index = childFor(node, entry);
+        Split split = insertInto(node->children[index].get(), std::move(entry));
+        if (!split.right) return {};
+
+        node->entries.insert(node->entries.begin() + index, std::move(split.separator));
+        node->children.insert(node->children.begin() + index + 1, std::move(split.right));
+        if (node->children.size() <= NODE_CAPACITY) return {};
+
+        // Promote the middle separator and move everything after it right
+        auto right = std::make_unique<Node>();
+        right->leaf = false;
+        size_t middle = node->entries.size() / 2;
+        Entry separator = std::move(node->entries[middle]);
+        right->entries.assign(std::make_move_iterator(node->entries.begin() + middle + 1), std::make_move_iterator(node->entries.end()));
+        right->children.assign(std::make_move_iterator(node->children.begin() + middle + 1), std::make_move_iterator(node->children.end()));
+        node->entries.resize(middle);
+        node->children.resize(middle + 1);
+        return {std::move(separator), std::move(right)};
+    }
+};
+
+enum class IndexType {
+    HASH,   // cell text to rows; serves equality only
+    BTREE   // ordered on the typed value; serves equality, ranges, ORDER BY and MIN/MAX
+};
+
+struct Index {
+    std::string column;
+    std::unordered_map<std::string, std::vector<size_t>> indexMap;
+
+    IndexType type = IndexType::HASH;
+    bool typedKeys = false;          // BTREE keyed by the stored int64 values
+    BPlusTree<int64_t> typedTree;
+    BPlusTree<std::string> textTree;
+};
+
+enum class DataType {
+    INTEGER,
+    STRING,
+    DATE
+};
+
+// Days since 1970-01-01 for a proleptic Gregorian calendar date
+int64_t daysFromCivil(int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    const unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+}
+
+// Inverse of daysFromCivil
+void civilFromDays(int64_t days, int64_t& year, unsigned& month, unsigned& day) {
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned mp = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2);
+}
+
+// Parse an integer written exactly as std::to_string would print it, so the
+// stored value can be turned back into the original text
+bool parseCanonicalInteger(std::string_view text, int64_t& value) {
+    if (text.empty()) return false;
+    const char* first = text.data();
+    const char* last = text.data() + text.size();
+    auto [ptr, ec] = std::from_chars(first, last, value);
+    if (ec != std::errc() || ptr != last) return false;
+    // Reject "+1", "007" and "-0" which would not round-trip
+    size_t digits = (text[0] == '-') ? 1 : 0;
+    if (text.size() > digits + 1 && text[digits] == '0') return false;
+    if (value == 0 && text[0] == '-') return false;
+    return true;
+}
+
+// Parse the leading integer of text the way std::stoi does (leading spaces,
+// a sign and trailing garbage are allowed, the value must fit an int), but
+// report failure instead of throwing
+bool parseLeadingInteger(std::string_view text, int& value) {
+    size_t i = 0;
+    while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+    if (i + 1 < text.size() && text[i] == '+' && text[i + 1] != '-') ++i;  // from_chars rejects '+'
+    auto [ptr, ec] = std::from_chars(text.data() + i, text.data() + text.size(), value);
+    return ec == std::errc() && ptr != text.data() + i;
+}
+
+// Parse a "YYYY-MM-DD" date into days since 1970-01-01
+bool parseCanonicalDate(std::string_view text, int64_t& days) {
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-') return false;
+    for (size_t i : {0, 1, 2, 3, 5, 6, 8, 9}) {
+        if (text[i] < '0' || text[i] > '9') return false;
+    }
+    int64_t year = (text[0] - '0') * 1000 + (text[1] - '0') * 100 + (text[2] - '0') * 10 + (text[3] - '0');
+    unsigned month = (text[5] - '0') * 10 + (text[6] - '0');
+    unsigned day = (text[8] - '0') * 10 + (text[9] - '0');
+    if (month < 1 || month > 12 || day < 1) return false;
+
+    static const unsigned daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    unsigned monthDays = daysInMonth[month - 1] + ((month == 2 && leap) ? 1 : 0);
+    if (day > monthDays) return false;
+
+    days = daysFromCivil(year, month, day);
+    return true;
+}
+
+std::string formatDate(int64_t days) {
+    int64_t year;
+    unsigned month, day;
+    civilFromDays(days, year, month, day);
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "%04lld-%02u-%02u", static_cast<long long>(year), month, day);
+    return buffer;
+}
+
+// Number of rows held by one storage block of a Column
+constexpr size_t BLOCK_ROWS = 4096;
+
+// Columnar storage for one column of a Table. Cells are kept in fixed-size
+// blocks so that growing a column never copies the data already stored.
+// INTEGER cells are stored as int64 and DATE cells as days since 1970-01-01;
+// STRING cells are stored as offsets into a per-block byte buffer.
+// If a typed column receives a cell it cannot store exactly (for example
+// "85.5" in an INTEGER column) the whole column falls back to text storage,
+// so every cell always reads back exactly as it was written.
+// Text columns may instead be dictionary encoded: each distinct value is
+// stored once and cells hold a small integer code into that dictionary.
+// Blocks and the dictionary are shared between copies of a Column and
+// copied on the first write while shared, so a copy is a cheap snapshot.
+class Column {
+public:
+    struct Block {
+        std::vector<int64_t> values;     // typed storage
+        std::vector<uint32_t> offsets;   // text storage: cell i is bytes[offsets[i], offsets[i + 1])
+        std::string bytes;
+        std::vector<uint32_t> codes;     // dictionary storage
+
+        // Zone map of typed storage: the smallest and largest value in the
+        // block, kept exact on every write so scans can skip the block and
+        // MIN/MAX can be read off it. A typed cell is never null.
+        int64_t minValue = std::numeric_limits<int64_t>::max();
+        int64_t maxValue = std::numeric_limits<int64_t>::min();
+
+        size_t size() const {
+            if (!offsets.empty()) return offsets.size() - 1;
+            return codes.empty() ? values.size() : codes.size();
+        }
+
+        void summarize() {
+            minValue = std::numeric_limits<int64_t>::max();
+            maxValue = std::numeric_limits<int64_t>::min();
+            for (int64_t value : values) include(value);
+        }
+
+        void include(int64_t value) {
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, value);
+        }
+    };
+
+    explicit Column(DataType columnType = DataType::STRING)
+        : type(columnType), textStorage(columnType == DataType::STRING) {}
+
+    DataType getType() const { return type; }
+
+    // true when cells are stored as text rather than as int64 values
+    bool isText() const { return textStorage; }
+
+    // true when text cells are stored as dictionary codes
+    bool isDictionary() const { return dictionaryEncoded; }
+
+    size_t size() const { return count; }
+
+    // Bytes the cells take in their blocks (not counting the dictionary)
+    size_t storageBytes() const {
+        size_t bytes = 0;
+        for (const auto& block : blocks) {
+            bytes += block->values.size() * sizeof(int64_t) + block->offsets.size() * sizeof(uint32_t) +
+                     block->bytes.size() + block->codes.size() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    const std::vector<std::shared_ptr<Block>>& getBlocks() const { return blocks; }
+
+    // Append a cell; false if it is not a valid value of the column's type
+    // (the column then stores it as text)
+    bool append(std::string_view cell) {
+        int64_t value;
+        if (!textStorage) {
+            if (encode(cell, value)) {
+                appendValue(value);
+                return true;
+            }
+            demoteToText();
+            appendText(cell);
+            return false;
+        }
+        appendText(cell);
+        return type == DataType::STRING || encode(cell, value);
+    }
+
+    // Append every cell of other, a column of the same type
+    void appendColumn(const Column& other) {
+        if (!textStorage && other.textStorage) demoteToText();
+        for (size_t row = 0; row < other.count; ++row) {
+            if (!textStorage) appendValue(other.value(row));
+            else if (other.textStorage) appendText(other.view(row));
+            else appendText(other.decode(other.value(row)));
+        }
+    }
+
+    // Text of a cell, formatted back from the typed value if necessary
+    std::string get(size_t row) const {
+        if (textStorage) return std::string(view(row));
+        return decode(value(row));
+    }
+
+    // Text of a cell stored as text; only valid when isText()
+    std::string_view view(size_t row) const {
+        if (dictionaryEncoded) return dictionary->values[code(row)];
+        const Block& block = *blocks[row / BLOCK_ROWS];
+        size_t i = row % BLOCK_ROWS;
+        return std::string_view(block.bytes.data() + block.offsets[i], block.offsets[i + 1] - block.offsets[i]);
+    }
+
+    // Typed value of a cell; only valid when !isText()
+    int64_t value(size_t row) const {
+        return blocks[row / BLOCK_ROWS]->values[row % BLOCK_ROWS];
+    }
+
+    // Dictionary code of a cell; only valid when isDictionary()
+    uint32_t code(size_t row) const {
+        return blocks[row / BLOCK_ROWS]->codes[row % BLOCK_ROWS];
+    }
+
+    const std::vector<std::string>& getDictionary() const { return dictionary->values; }
+
+    // Code of text in the dictionary; false if the text was never stored
+    bool findCode(std::string_view text, uint32_t& out) const {
+        auto it = dictionary->lookup.find(std::string(text));
+        if (it == dictionary->lookup.end()) return false;
+        out = it->second;
+        return true;
+    }
+
+    // Switch a text column to dictionary encoding
+    void enableDictionary() {
+        if (!textStorage || dictionaryEncoded) return;
+        Column encoded(type);
+        encoded.textStorage = true;
+        encoded.dictionaryEncoded = true;
+        for (size_t row = 0; row < count; ++row) {
+            encoded.appendText(view(row));
+        }
+        *this = std::move(encoded);
+    }
+
+    // Encode text as the typed value this column would store for it
+    bool encode(std::string_view text, int64_t& out) const {
+        if (type == DataType::INTEGER) return parseCanonicalInteger(text, out);
+        if (type == DataType::DATE) return parseCanonicalDate(text, out);
+        return false;
+    }
+
+    std::string decode(int64_t stored) const {
+        return type == DataType::DATE ? formatDate(stored) : std::to_string(stored);
+    }
+
+    // Does the cell hold exactly this text?
+    bool equals(size_t row, std::string_view text) const {
+        if (textStorage) return view(row) == text;
+        int64_t encoded;
+        return encode(text, encoded) && value(row) == encoded;
+    }
+
+    // Whether set(row, cell) changes only the block holding row
+    bool setsInPlace(std::string_view cell) const {
+        if (!textStorage) {
+            int64_t encoded;
+            return encode(cell, encoded);
+        }
+        uint32_t cellCode;
+        return !dictionaryEncoded || findCode(cell, cellCode);
+    }
+
+    void set(size_t row, std::string_view cell) {
+        if (!textStorage) {
+            int64_t encoded;
+            if (encode(cell, encoded)) {
+                Block& block = mutableBlock(row / BLOCK_ROWS);
+                int64_t& stored = block.values[row % BLOCK_ROWS];
+                bool wasBound = (stored == block.minValue || stored == block.maxValue);
+                stored = encoded;
+                if (wasBound) block.summarize();
+                else block.include(encoded);
+                return;
+            }
+            demoteToText();
+        }
+
+        if (dictionaryEncoded) {
+            uint32_t cellCode = internCode(cell);
+            mutableBlock(row / BLOCK_ROWS).codes[row % BLOCK_ROWS] = cellCode;
+            return;
+        }
+
+        Block& block = mutableBlock(row / BLOCK_ROWS);
+        size_t i = row % BLOCK_ROWS;
+        uint32_t start = block.offsets[i];
+        uint32_t oldLength = block.offsets[i + 1] - start;
+        block.bytes.replace(start, oldLength, cell.data(), cell.size());
+        int64_t delta = static_cast<int64_t>(cell.size()) - oldLength;
+        for (size_t j = i + 1; j < block.offsets.size(); ++j) {
+            block.offsets[j] = static_cast<uint32_t>(block.offsets[j] + delta);
+        }
+    }
+
+    // Remove all cells; a dictionary-encoded column stays dictionary encoded
+    void clear() {
+        blocks.clear();
+        dictionary = std::make_shared<Dictionary>();
+        count = 0;
+        textStorage = (type == DataType::STRING) || dictionaryEncoded;
+    }
+
+    // Reorder cells so that new row i holds old row order[i]
+    void permute(const std::vector<size_t>& order) {
+        Column reordered = emptyLike();
+        for (size_t row : order) {
+            reordered.appendStored(*this, row);
+        }
+        reordered.dictionary = std::move(dictionary);
+        *this = std::move(reordered);
+    }
+
+    // Empty the column and choose how cells are stored; used when loading a
+    // saved table. A STRING column is always stored as text.
+    void resetLayout(bool text, bool dictionary) {
+        blocks.clear();
+        this->dictionary = std::make_shared<Dictionary>();
+        count = 0;
+        textStorage = text || dictionary || type == DataType::STRING;
+        dictionaryEncoded = dictionary;
+    }
+
+    // Set the values of a dictionary-encoded column before its codes are
+    // loaded; false if a value repeats
+    bool loadDictionary(std::vector<std::string> values) {
+        if (!dictionaryEncoded || count != 0) return false;
+        auto loaded = std::make_shared<Dictionary>();
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (!loaded->lookup.emplace(values[i], static_cast<uint32_t>(i)).second) return false;
+        }
+        loaded->values = std::move(values);
+        dictionary = std::move(loaded);
+        return true;
+    }
+
+    // Append a whole block read from a saved table. Every earlier block must
+    // be full and the block must match this column's layout; false if not.
+    bool loadBlock(Block block) {
+        size_t rows = block.size();
+        if (count % BLOCK_ROWS != 0 || rows == 0 || rows > BLOCK_ROWS) return false;
+        if (!textStorage) {
+            if (!block.offsets.empty() || !block.codes.empty()) return false;
+            if (type == DataType::DATE) {
+                // Only days that parseCanonicalDate can produce (years 0000-9999)
+                static const int64_t firstDay = daysFromCivil(0, 1, 1);
+                static const int64_t lastDay = daysFromCivil(9999, 12, 31);
+                for (int64_t days : block.values) {
+                    if (days < firstDay || days > lastDay) return false;
+                }
+            }
+        } else if (dictionaryEncoded) {
+            if (!block.values.empty() || !block.offsets.empty()) return false;
+            for (uint32_t cellCode : block.codes) {
+                if (cellCode >= dictionary->values.size()) return false;
+            }
+        } else {
+            if (!block.values.empty() || !block.codes.empty() || block.offsets.front() != 0) return false;
+            for (size_t i = 1; i < block.offsets.size(); ++i) {
+                if (block.offsets[i] < block.offsets[i - 1]) return false;
+            }
+            if (block.offsets.back() != block.bytes.size()) return false;
+        }
+        block.summarize();
+        blocks.push_back(std::make_shared<Block>(std::move(block)));
+        count += rows;
+        return true;
+    }
+
+    // Remove the given rows (sorted ascending, no duplicates)
+    void erase(const std::vector<size_t>& sortedRows) {
+        if (sortedRows.empty()) return;
+
+        // Blocks before the first removed row are untouched; rebuild the rest
+        size_t firstBlock = sortedRows.front() / BLOCK_ROWS;
+        Column rebuilt = emptyLike();
+        rebuilt.blocks.assign(std::make_move_iterator(blocks.begin()), std::make_move_iterator(blocks.begin() + firstBlock));
+        rebuilt.count = firstBlock * BLOCK_ROWS;
+
+        size_t next = 0;
+        for (size_t row = firstBlock * BLOCK_ROWS; row < count; ++row) {
+            if (next < sortedRows.size() && sortedRows[next] == row) {
+                ++next;
+                continue;
+            }
+            rebuilt.appendStored(*this, row);
+        }
+        rebuilt.dictionary = std::move(dictionary);
+        *this = std::move(rebuilt);
+    }
+
+private:
+    DataType type;
+    bool textStorage;
+    bool dictionaryEncoded = false;
+    std::vector<std::shared_ptr<Block>> blocks;
+    size_t count = 0;
+
+    struct Dictionary {
+        std::vector<std::string> values;
+        std::unordered_map<std::string, uint32_t> lookup;
+    };
+    std::shared_ptr<Dictionary> dictionary = std::make_shared<Dictionary>();
+
+    // True when nothing but this column holds shared. use_count() is a
+    // relaxed load, so the fence orders our writes after the reads a
+    // snapshot made before it let go of the object.
+    template <typename T>
+    static bool unshared(const std::shared_ptr<T>& shared) {
+        if (shared.use_count() > 1) return false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    // A block this column may change: copied first if a snapshot shares it
+    Block& mutableBlock(size_t index) {
+        if (!unshared(blocks[index])) blocks[index] = std::make_shared<Block>(*blocks[index]);
+        return *blocks[index];
+    }
+
+    Block& tailBlock() {
+        if (count % BLOCK_ROWS == 0) {
+            blocks.push_back(std::make_shared<Block>());
+            if (textStorage && !dictionaryEncoded) blocks.back()->offsets.push_back(0);
+            return *blocks.back();
+        }
+        return mutableBlock(blocks.size() - 1);
+    }
+
+    // Empty column using the same storage layout as this one
+    Column emptyLike() const {
+        Column empty(type);
+        empty.textStorage = textStorage;
+        empty.dictionaryEncoded = dictionaryEncoded;
+        return empty;
+    }
+
+    // Append cell row of source, which must use the same storage layout
+    void appendStored(const Column& source, size_t row) {
+        if (!textStorage) appendValue(source.value(row));
+        else if (dictionaryEncoded) appendCode(source.code(row));
+        else appendText(source.view(row));
+    }
+
+    uint32_t internCode(std::string_view cell) {
+        auto found = dictionary->lookup.find(std::string(cell));
+        if (found != dictionary->lookup.end()) return found->second;
+        if (!unshared(dictionary)) dictionary = std::make_shared<Dictionary>(*dictionary);
+        uint32_t cellCode = static_cast<uint32_t>(dictionary->values.size());
+        dictionary->lookup.emplace(std::string(cell), cellCode);
+        dictionary->values.emplace_back(cell);
+        return cellCode;
+    }
+
+    void appendCode(uint32_t cellCode) {
+        tailBlock().codes.push_back(cellCode);
+        ++count;
+    }
+
+    void appendValue(int64_t stored) {
+        Block& block = tailBlock();
+        block.values.push_back(stored);
+        block.include(stored);
+        ++count;
+    }
+
+    void appendText(std::string_view cell) {
+        if (dictionaryEncoded) {
+            appendCode(internCode(cell));
+            return;
+        }
+        Block& block = tailBlock();
+        block.bytes.append(cell.data(), cell.size());
+        block.offsets.push_back(static_cast<uint32_t>(block.bytes.size()));
+        ++count;
+    }
+
+    void demoteToText() {
+        Column text(type);
+        text.textStorage = true;
+        for (size_t row = 0; row < count; ++row) {
+            text.appendText(decode(value(row)));
+        }
+        *this = std::move(text);
+    }
+};
+
+// Binary table files are made of PAGE_SIZE pages:
+//   header    magic, version, page size, byte-order mark, column and row
+//             counts, the last write-ahead log sequence the rows include,
+//             table name, then name, DataType and storage of each column;
+//             padded to a page
+//   chunks    one per column block (int64 values, text offsets and bytes, or
+//             dictionary codes) plus one per dictionary, each starting on a
+//             page boundary
+//   footer    a TableFileChunk for every chunk, and a TableFileTrailer in the
+//             last bytes of the file pointing back at the footer
+// Numbers are written in host byte order; the byte-order mark makes a file
+// from a machine with the other byte order fail to load instead of misread.
+constexpr char TABLE_FILE_MAGIC[8] = {'D', 'B', 'M', 'S', 'T', 'B', 'L', '1'};
+constexpr char TABLE_FILE_END[8] = {'D', 'B', 'M', 'S', 'E', 'N', 'D', '1'};
+constexpr uint32_t TABLE_FILE_VERSION = 2;   // 2 added the log sequence to the header
+constexpr uint32_t TABLE_FILE_BYTE_ORDER = 0x01020304;
+constexpr size_t PAGE_SIZE = 4096;
+
+enum class ChunkKind : uint32_t {
+    VALUES = 1,      // int64 per row
+    TEXT = 2,        // uint32 offsets (rows + 1), then the bytes
+    CODES = 3,       // uint32 dictionary code per row
+    DICTIONARY = 4   // uint32 length and bytes per dictionary value
+};
+
+enum class ColumnStorage : uint8_t {
+    TYPED = 0,
+    TEXT = 1,
+    DICTIONARY = 2
+};
+
+struct TableFileChunk {
+    uint32_t column;
+    uint32_t kind;      // a ChunkKind
+    uint32_t rows;      // rows (or dictionary values) in the chunk
+    uint32_t reserved;
+    uint64_t offset;    // from the start of the file, page aligned
+    uint64_t length;    // bytes of payload, before padding
+};
+
+struct TableFileTrailer {
+    uint64_t footerOffset;
+    uint64_t chunkCount;
+    char magic[8];
+};
+
+static_assert(sizeof(TableFileChunk) == 32 && sizeof(TableFileTrailer) == 24, "table file records must not be padded");
+
+// Read-only mapping of a whole file. An empty file opens with size() == 0.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize)) {
+            length = static_cast<size_t>(fileSize.QuadPart);
+            opened = true;
+            if (length > 0) {
+                mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping) bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                opened = (bytes != nullptr);
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (::fstat(fd, &info) == 0) {
+            length = static_cast<size_t>(info.st_size);
+            opened = true;
+            if (length > 0) {
+                void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    ::madvise(mapped, length, MADV_SEQUENTIAL);
+                    bytes = static_cast<const char*>(mapped);
+                }
+                opened = (bytes != nullptr);
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+#else
+        if (bytes) ::munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return opened; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#if defined(_WIN32)
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// Bounds-checked reads from a byte range. A read past the end fails and
+// leaves the reader failed, so callers can check once after a sequence.
+class ByteReader {
+public:
+    ByteReader(const char* data, size_t size) : bytes(data), length(size) {}
+
+    template <typename T>
+    bool read(T& out) {
+        static_assert(std::is_trivially_copyable<T>::value, "read copies raw bytes");
+        return readBytes(&out, sizeof(T));
+    }
+
+    bool readBytes(void* out, size_t size) {
+        if (!ok || size > length - position) return ok = false;
+        if (size == 0) return true;
+        std::memcpy(out, bytes + position, size);
+        position += size;
+        return true;
+    }
+
+    bool readString(std::string& out) {
+        uint32_t size;
+        if (!read(size) || size > length - position) return ok = false;
+        out.assign(bytes + position, size);
+        position += size;
+        return true;
+    }
+
+    bool good() const { return ok; }
+
+    bool atEnd() const { return position == length; }
+
+private:
+    const char* bytes;
+    size_t length;
+    size_t position = 0;
+    bool ok = true;
+};
+
+// First ',', '\n' or '\r' in [p, end), or end. SSE2 tests 16 bytes at a time.
+const char* findCsvDelimiter(const char* p, const char* end) {
+#if defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(','), newline = _mm_set1_epi8('\n'), carriage = _mm_set1_epi8('\r');
+    for (; end - p >= 16; p += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, comma), _mm_cmpeq_epi8(bytes, newline)),
+                                    _mm_cmpeq_epi8(bytes, carriage));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == ',' || *p == '\n' || *p == '\r') return p;
+    }
+    return end;
+}
+
+// Number of '"' in [p, end)
+size_t countCsvQuotes(const char* p, const char* end) {
+    size_t quotes = 0;
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    for (; end - p >= 16; p += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        quotes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)));
+    }
+#endif
+    for (; p < end; ++p) quotes += (*p == '"');
+    return quotes;
+}
+
+// Append a field to a CSV (or TSV) record, in double quotes with "" for
+// each quote when it holds the delimiter, a quote or a line break (RFC 4180)
+void appendCsvField(std::string& out, std::string_view field, char delimiter) {
+    const char specials[] = {delimiter, '"', '\n', '\r', '\0'};
+    if (field.find_first_of(specials) == std::string_view::npos) {
+        out.append(field.data(), field.size());
+        return;
+    }
+    out.push_back('"');
+    for (char c : field) {
+        if (c == '"') out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+// Reads RFC 4180 records from a byte range: fields separated by commas,
+// records by "\n" or "\r\n", and fields in double quotes may hold commas,
+// line breaks and "" for a quote. Fields point into the range except for
+// quoted fields with "" in them, which are unescaped into a buffer.
+class CsvReader {
+public:
+    CsvReader(const char* begin, const char* end) : p(begin), end(end) {}
+
+    bool atEnd() const { return p >= end; }
+
+    // Read the next record; fields stay valid until the next call
+    void next(std::vector<std::string_view>& fields) {
+        fields.clear();
+        refs.clear();
+        unescaped.clear();
+        for (;;) {
+            if (p < end && *p == '"') {
+                readQuoted();
+                while (p < end && *p != ',' && *p != '\n' && *p != '\r') ++p;  // text after the closing quote is dropped
+            } else {
+                const char* delimiter = findCsvDelimiter(p, end);
+                refs.push_back({p, 0, static_cast<size_t>(delimiter - p), false});
+                p = delimiter;
+            }
+            if (p < end && *p == ',') {
+                ++p;
+                continue;
+            }
+            if (p < end && *p == '\r') ++p;
+            if (p < end && *p == '\n') ++p;
+            break;
+        }
+        for (const auto& ref : refs) {
+            fields.emplace_back(ref.copied ? unescaped.data() + ref.offset : ref.start, ref.length);
+        }
+    }
+
+private:
+    struct FieldRef {
+        const char* start;
+        size_t offset;     // into unescaped, when copied
+        size_t length;
+        bool copied;
+    };
+
+    const char* p;
+    const char* end;
+    std::vector<FieldRef> refs;
+    std::string unescaped;
+
+    void readQuoted() {
+        const char* start = ++p;
+        bool copied = false;
+        size_t offset = 0;
+        for (;;) {
+            const char* quote = static_cast<const char*>(std::memchr(p, '"', end - p));
+            if (!quote) quote = end;  // unterminated: the field runs to the end
+            if (copied) unescaped.append(p, quote - p);
+            if (quote + 1 < end && quote[1] == '"') {
+                if (!copied) {
+                    copied = true;
+                    offset = unescaped.size();
+                    unescaped.append(start, quote - start);
+                }
+                unescaped.push_back('"');
+                p = quote + 2;
+                continue;
+            }
+            if (copied) refs.push_back({nullptr, offset, unescaped.size() - offset, true});
+            else refs.push_back({start, 0, static_cast<size_t>(quote - start), false});
+            p = (quote < end) ? quote + 1 : end;
+            return;
+        }
+    }
+};
+
+// Sequential writer that tracks the file position so chunks can be page
+// aligned and their offsets recorded
+class PageWriter {
+public:
+    explicit PageWriter(std::ostream& stream) : out(stream) {}
+
+    void writeBytes(const void* data, size_t size) {
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        position += size;
+    }
+
+    template <typename T>
+    void write(const T& value) {
+        writeBytes(&value, sizeof(T));
+    }
+
+    template <typename T>
+    void writeArray(const std::vector<T>& values) {
+        if (!values.empty()) writeBytes(values.data(), values.size() * sizeof(T));
+    }
+
+    void writeString(const std::string& text) {
+        write(static_cast<uint32_t>(text.size()));
+        writeBytes(text.data(), text.size());
+    }
+
+    // Pad with zeros so that the next write starts at a page boundary, less
+    // reserve bytes
+    void padToPage(size_t reserve = 0) {
+        size_t target = (position + reserve + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE - reserve;
+        static const char zeros[PAGE_SIZE] = {};
+        while (position < target) {
+            writeBytes(zeros, std::min(PAGE_SIZE, target - position));
+        }
+    }
+
+    uint64_t tell() const { return position; }
+
+private:
+    std::ostream& out;
+    uint64_t position = 0;
+};
+
+// Append the raw bytes of a value, or a length-prefixed string, to a buffer
+template <typename T>
+void appendBytes(std::string& out, const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "appendBytes copies raw bytes");
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void appendString(std::string& out, std::string_view text) {
+    appendBytes(out, static_cast<uint32_t>(text.size()));
+    out.append(text);
+}
+
+// FNV-1a, used to detect torn or corrupt log records
+uint32_t checksum32(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// Flush a file's contents to stable storage
+bool syncFile(const std::string& path) {
+#if defined(_WIN32)
+    int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+    if (fd < 0) return false;
+    bool ok = _commit(fd) == 0;
+    _close(fd);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+#endif
+    return ok;
+}
+
+// Replace target with source in one step, so readers see one or the other
+bool replaceFile(const std::string& source, const std::string& target) {
+#if defined(_WIN32)
+    return MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (std::rename(source.c_str(), target.c_str()) != 0) return false;
+    // The rename itself is durable once the directory is synced
+    size_t slash = target.find_last_of('/');
+    std::string directory = (slash == std::string::npos) ? "." : target.substr(0, slash + 1);
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+// How long commit waits before returning
+enum class Durability {
+    BUFFERED,   // records stay in memory until a later flush; a crash may lose recent commits
+    WRITTEN,    // records are handed to the OS; survives a process crash, not a power loss
+    SYNCED      // records are fsynced; concurrent commits share one fsync (group commit)
+};
+
+// Append-only redo log. Each record is framed as
+//   uint32 payload length, uint32 checksum32(payload), payload
+// Positions are logical byte counts since the log was opened; they keep
+// growing across reset() so a waiter never confuses old and new records.
+// Committers append under the caller's lock and then call sync() outside
+// it: the first to arrive writes and syncs everything buffered so far while
+// later committers wait for that flush, so one fsync covers many commits.
+class WriteAheadLog {
+public:
+    WriteAheadLog() = default;
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog() {
+        if (fd >= 0) {
+            sync(appended, Durability::WRITTEN);
+            closeFile();
+        }
+    }
+
+    // Open (or create) the log and return the payloads of the complete
+    // records it holds. A torn record at the end is cut off.
+    bool open(const std::string& path, std::vector<std::string>& records, std::string& error) {
+        size_t validBytes = 0;
+        {
+            MappedFile existing(path);
+            if (existing.isOpen()) {
+                ByteReader reader(existing.data(), existing.size());
+                uint32_t length, checksum;
+                while (reader.read(length) && reader.read(checksum)) {
+                    std::string payload(length <= existing.size() ? length : 0, '\0');
+                    if (length > existing.size() || !reader.readBytes(&payload[0], length) ||
+                        checksum32(payload.data(), payload.size()) != checksum) break;
+                    records.push_back(std::move(payload));
+                    validBytes += 2 * sizeof(uint32_t) + length;
+                }
+            }
+        }
+
+#if defined(_WIN32)
+        fd = _open(path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+        bool ok = fd >= 0 && _chsize_s(fd, validBytes) == 0 && _lseeki64(fd, 0, SEEK_END) >= 0;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        bool ok = fd >= 0 && ::ftruncate(fd, static_cast<off_t>(validBytes)) == 0 && ::lseek(fd, 0, SEEK_END) >= 0;
+#endif
+        if (!ok) {
+            error = "cannot open " + path;
+            closeFile();
+            return false;
+        }
+        return true;
+    }
+
+    // Buffer one record; returns the position that makes it durable
+    uint64_t append(const std::string& payload) {
+        std::lock_guard<std::mutex> lock(mutex);
+        appendBytes(pending, static_cast<uint32_t>(payload.size()));
+        appendBytes(pending, checksum32(payload.data(), payload.size()));
+        pending.append(payload);
+        appended += 2 * sizeof(uint32_t) + payload.size();
+        return appended;
+    }
+
+    // Wait until everything up to position is written (and synced, for
+    // SYNCED). BUFFERED only writes once enough records have piled up.
+    bool sync(uint64_t position, Durability level) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (level == Durability::BUFFERED) {
+            if (pending.size() < BUFFERED_LIMIT) return !failed;
+            level = Durability::WRITTEN;
+        }
+        const uint64_t& reached = (level == Durability::SYNCED) ? synced : written;
+        while (reached < position && !failed) {
+            if (flushing) {
+                flushed.wait(lock);
+                continue;
+            }
+            // Become the leader for everything buffered so far
+            flushing = true;
+            std::string batch;
+            batch.swap(pending);
+            uint64_t end = appended;
+            bool needSync = (level == Durability::SYNCED);
+            lock.unlock();
+            bool ok = writeAll(batch) && (!needSync || syncFd());
+            lock.lock();
+            if (ok) {
+                written = end;
+                if (needSync) synced = end;
+            } else {
+                failed = true;
+            }
+            flushing = false;
+            flushed.notify_all();
+        }
+        return !failed;
+    }
+
+    // Drop every record, once the table file holds their effects
+    bool reset() {
+        std::unique_lock<std::mutex> lock(mutex);
+        flushed.wait(lock, [&] { return !flushing; });
+        pending.clear();
+#if defined(_WIN32)
+        bool ok = _chsize_s(fd, 0) == 0 && _lseeki64(fd, 0, SEEK_SET) == 0 && _commit(fd) == 0;
+#else
+        bool ok = ::ftruncate(fd, 0) == 0 && ::lseek(fd, 0, SEEK_SET) == 0 && ::fsync(fd) == 0;
+#endif
+        written = synced = appended;
+        flushed.notify_all();
+        return ok;
+    }
+
+private:
+    static constexpr size_t BUFFERED_LIMIT = 1 << 20;
+
+    int fd = -1;
+    std::mutex mutex;
+    std::condition_variable flushed;
+    std::string pending;      // appended but not yet written
+    uint64_t appended = 0;
+    uint64_t written = 0;
+    uint64_t synced = 0;
+    bool flushing = false;
+    bool failed = false;
+
+    bool writeAll(const std::string& bytes) {
+        size_t done = 0;
+        while (done < bytes.size()) {
+#if defined(_WIN32)
+            int n = _write(fd, bytes.data() + done, static_cast<unsigned>(std::min<size_t>(bytes.size() - done, 1 << 30)));
+#else
+            ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+#endif
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool syncFd() {
+#if defined(_WIN32)
+        return _commit(fd) == 0;
+#elif defined(__APPLE__)
+        return ::fsync(fd) == 0;
+#else
+        return ::fdatasync(fd) == 0;
+#endif
+    }
+
+    void closeFile() {
+        if (fd < 0) return;
+#if defined(_WIN32)
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+        fd = -1;
+    }
+};
+
+enum class CompareOp {
+    EQ, NE, LT, GT, LE, GE,
+    INVALID
+};
+
+CompareOp parseCompareOp(const std::string& op) {
+    if (op == "==") return CompareOp::EQ;
+    if (op == "!=") return CompareOp::NE;
+    if (op == "<") return CompareOp::LT;
+    if (op == ">") return CompareOp::GT;
+    if (op == "<=") return CompareOp::LE;
+    if (op == ">=") return CompareOp::GE;
+    return CompareOp::INVALID;
+}
+
+template <typename T>
+bool applyCompare(CompareOp op, const T& lhs, const T& rhs) {
+    switch (op) {
+        case CompareOp::EQ: return lhs == rhs;
+        case CompareOp::NE: return lhs != rhs;
+        case CompareOp::LT: return lhs < rhs;
+        case CompareOp::GT: return lhs > rhs;
+        case CompareOp::LE: return lhs <= rhs;
+        case CompareOp::GE: return lhs >= rhs;
+        default: return false;
+    }
+}
+
+// Call fn with the comparison functor for op, so a scan can pick its
+// operator once instead of once per row; false if op is INVALID
+template <typename Fn>
+bool withCompareOp(CompareOp op, Fn&& fn) {
+    switch (op) {
+        case CompareOp::EQ: fn(std::equal_to<>()); return true;
+        case CompareOp::NE: fn(std::not_equal_to<>()); return true;
+        case CompareOp::LT: fn(std::less<>()); return true;
+        case CompareOp::GT: fn(std::greater<>()); return true;
+        case CompareOp::LE: fn(std::less_equal<>()); return true;
+        case CompareOp::GE: fn(std::greater_equal<>()); return true;
+        default: return false;
+    }
+}
+
+// Parse the leading number of text the way std::stod does (leading spaces
+// and trailing garbage are allowed), but report failure instead of throwing
+bool parseLeadingNumber(std::string_view text, double& value) {
+    size_t i = 0;
+    while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+    if (i + 1 < text.size() && text[i] == '+' && text[i + 1] != '-') ++i;  // from_chars rejects '+'
+    auto [ptr, ec] = std::from_chars(text.data() + i, text.data() + text.size(), value);
+    return ec == std::errc() && ptr != text.data() + i;
+}
+
+// Compare a text cell with a condition constant: numerically when both are
+// numbers, otherwise as strings where only == and != can match
+bool compareCellText(std::string_view cell, CompareOp op, bool constantNumeric, double constantNumber, std::string_view constantText) {
+    double cellNumber;
+    if (constantNumeric && parseLeadingNumber(cell, cellNumber)) {
+        return applyCompare(op, cellNumber, constantNumber);
+    }
+    if (op == CompareOp::EQ) return cell == constantText;
+    if (op == CompareOp::NE) return cell != constantText;
+    return false;
+}
+
+// Rewrite "integer op number" as an equivalent comparison with an int64
+// bound, so integer cells never need converting to double. Returns false
+// when every integer gives the same answer, which is stored in outcome.
+bool integerBound(CompareOp& op, double number, int64_t& bound, bool& outcome) {
+    const double limit = 9223372036854775808.0;  // 2^63
+    if (std::isnan(number)) {
+        outcome = (op == CompareOp::NE);
+        return false;
+    }
+    if (number >= limit || number < -limit) {
+        bool aboveAll = number >= limit;
+        outcome = (op == CompareOp::NE) ||
+                  (aboveAll && (op == CompareOp::LT || op == CompareOp::LE)) ||
+                  (!aboveAll && (op == CompareOp::GT || op == CompareOp::GE));
+        return false;
+    }
+
+    double lower = std::floor(number);
+    double upper = std::ceil(number);
+    switch (op) {
+        case CompareOp::EQ:
+        case CompareOp::NE:
+            if (lower != number) {
+                outcome = (op == CompareOp::NE);
+                return false;
+            }
+            bound = static_cast<int64_t>(number);
+            return true;
+        case CompareOp::LT:   // v < 20.5  <=>  v < 21
+        case CompareOp::GE:   // v >= 20.5 <=>  v >= 21
+            bound = static_cast<int64_t>(upper);
+            return true;
+        case CompareOp::LE:   // v <= 20.5 <=>  v <= 20
+        case CompareOp::GT:   // v > 20.5  <=>  v > 20
+            bound = static_cast<int64_t>(lower);
+            return true;
+        default:
+            outcome = false;
+            return false;
+    }
+}
+
+// Set of selected row positions, one bit per row
+class SelectionBitmap {
+public:
+    explicit SelectionBitmap(size_t rows = 0) : bitCount(rows), words((rows + 63) / 64, 0) {}
+
+    size_t size() const { return bitCount; }
+
+    void set(size_t row) { words[row / 64] |= uint64_t(1) << (row % 64); }
+
+    bool test(size_t row) const { return (words[row / 64] >> (row % 64)) & 1; }
+
+    void setAll() {
+        std::fill(words.begin(), words.end(), ~uint64_t(0));
+        clearTail();
+    }
+
+    // Word holding bit `row`; row must be a multiple of 64
+    uint64_t* wordsAt(size_t row) { return words.data() + row / 64; }
+
+    // Set bits [begin, end); begin must be a multiple of 64
+    void setRange(size_t begin, size_t end) {
+        std::fill(words.begin() + begin / 64, words.begin() + end / 64, ~uint64_t(0));
+        if (end % 64 != 0) words[end / 64] |= (uint64_t(1) << (end % 64)) - 1;
+    }
+
+    // Copy part's bits in starting at bit `row`; row must be a multiple of 64
+    void assignAt(size_t row, const SelectionBitmap& part) {
+        std::copy(part.words.begin(), part.words.end(), words.begin() + row / 64);
+    }
+
+    void andWith(const SelectionBitmap& other) {
+        for (size_t i = 0; i < words.size(); ++i) words[i] &= other.words[i];
+    }
+
+    void orWith(const SelectionBitmap& other) {
+        for (size_t i = 0; i < words.size(); ++i) words[i] |= other.words[i];
+    }
+
+    void andNotWith(const SelectionBitmap& other) {
+        for (size_t i = 0; i < words.size(); ++i) words[i] &= ~other.words[i];
+    }
+
+    bool none() const {
+        for (uint64_t word : words) {
+            if (word) return false;
+        }
+        return true;
+    }
+
+    size_t count() const {
+        size_t total = 0;
+        for (uint64_t word : words) total += __builtin_popcountll(word);
+        return total;
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (size_t i = 0; i < words.size(); ++i) {
+            uint64_t word = words[i];
+            while (word) {
+                fn(i * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+    std::vector<size_t> positions() const {
+        std::vector<size_t> result;
+        result.reserve(count());
+        forEach([&](size_t row) { result.push_back(row); });
+        return result;
+    }
+
+private:
+    size_t bitCount;
+    std::vector<uint64_t> words;
+
+    void clearTail() {
+        if (bitCount % 64 != 0) words.back() &= (uint64_t(1) << (bitCount % 64)) - 1;
+    }
+};
+
+// Compare kernels: set bit i of out (counting from bit 0 of out[0]) when
+// values[i] op constant. Bits past n in the last word are left clear.
+// out must hold (n + 63) / 64 words and is overwritten.
+void compareInt64Scalar(const int64_t* values, size_t n, CompareOp op, int64_t constant, uint64_t* out) {
+    withCompareOp(op, [&](auto compare) {
+        for (size_t w = 0; w * 64 < n; ++w) {
+            size_t end = std::min(n, w * 64 + 64);
+            uint64_t word = 0;
+            for (size_t i = w * 64; i < end; ++i) {
+                word |= uint64_t(compare(values[i], constant)) << (i - w * 64);
+            }
+            out[w] = word;
+        }
+    });
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DBMS_X86_KERNELS 1
+
+// AVX2: four int64 lanes per compare. Every operator is built from == and >
+// (a < b is b > a; <=, >= and != are the inverse of >, < and ==).
+__attribute__((target("avx2")))
+void compareInt64Avx2(const int64_t* values, size_t n, CompareOp op, int64_t constant, uint64_t* out) {
+    const __m256i c = _mm256_set1_epi64x(constant);
+    bool invert = (op == CompareOp::NE || op == CompareOp::LE || op == CompareOp::GE);
+    size_t fullWords = n / 64;
+    for (size_t w = 0; w < fullWords; ++w) {
+        uint64_t word = 0;
+        for (size_t lane = 0; lane < 64; lane += 4) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + w * 64 + lane));
+            __m256i mask;
+            switch (op) {
+                case CompareOp::EQ: case CompareOp::NE: mask = _mm256_cmpeq_epi64(v, c); break;
+                case CompareOp::GT: case CompareOp::LE: mask = _mm256_cmpgt_epi64(v, c); break;
+                default:                                mask = _mm256_cmpgt_epi64(c, v); break;  // LT, GE
+            }
+            word |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(mask))) << lane;
+        }
+        out[w] = invert ? ~word : word;
+    }
+    if (n % 64 != 0) compareInt64Scalar(values + fullWords * 64, n % 64, op, constant, out + fullWords);
+}
+
+// SSE4.2: two int64 lanes per compare
+__attribute__((target("sse4.2")))
+void compareInt64Sse42(const int64_t* values, size_t n, CompareOp op, int64_t constant, uint64_t* out) {
+    const __m128i c = _mm_set1_epi64x(constant);
+    bool invert = (op == CompareOp::NE || op == CompareOp::LE || op == CompareOp::GE);
+    size_t fullWords = n / 64;
+    for (size_t w = 0; w < fullWords; ++w) {
+        uint64_t word = 0;
+        for (size_t lane = 0; lane < 64; lane += 2) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + w * 64 + lane));
+            __m128i mask;
+            switch (op) {
+                case CompareOp::EQ: case CompareOp::NE: mask = _mm_cmpeq_epi64(v, c); break;
+                case CompareOp::GT: case CompareOp::LE: mask = _mm_cmpgt_epi64(v, c); break;
+                default:                                mask = _mm_cmpgt_epi64(c, v); break;  // LT, GE
+            }
+            word |= uint64_t(_mm_movemask_pd(_mm_castsi128_pd(mask))) << lane;
+        }
+        out[w] = invert ? ~word : word;
+    }
+    if (n % 64 != 0) compareInt64Scalar(values + fullWords * 64, n % 64, op, constant, out + fullWords);
+}
+#endif
+
+using CompareKernel = void (*)(const int64_t*, size_t, CompareOp, int64_t, uint64_t*);
+
+// Pick the widest kernel the running CPU supports, once
+CompareKernel selectCompareKernel() {
+#ifdef DBMS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return compareInt64Avx2;
+    if (__builtin_cpu_supports("sse4.2")) return compareInt64Sse42;
+#endif
+    return compareInt64Scalar;
+}
+
+void compareInt64(const int64_t* values, size_t n, CompareOp op, int64_t constant, uint64_t* out) {
+    if (op == CompareOp::INVALID) {
+        std::fill(out, out + (n + 63) / 64, 0);
+        return;
+    }
+    static const CompareKernel kernel = selectCompareKernel();
+    kernel(values, n, op, constant, out);
+}
+
+// A Condition / ConditionGroup tree compiled once against a table: column
+// names are resolved to indices, constants are parsed into typed values and
+// operators into CompareOp, so evaluating a row does no parsing at all.
+// Nodes live in one vector and groups refer to their children by position.
+struct PredicatePlan {
+    enum class Kind {
+        CONSTANT,    // always `result` (missing column, bad operator, ...)
+        AND,
+        OR,
+        INTEGER,     // typed INTEGER cell compared with `bound`
+        DATE,        // typed DATE cell (day number) compared with `bound`
+        DATE_YEAR,   // year of a typed DATE cell compared with `number`
+        DICTIONARY,  // outcome precomputed per dictionary code
+        TEXT         // text cell compared with compareCellText
+    };
+
+    struct Node {
+        Kind kind = Kind::CONSTANT;
+        bool result = false;
+        std::vector<size_t> children;
+
+        size_t column = 0;
+        CompareOp op = CompareOp::INVALID;
+        bool numeric = false;    // constant parsed as a number
+        double number = 0.0;
+        int64_t bound = 0;
+        bool dateBound = false;  // DATE column stored as text, constant a date (day number in `bound`)
+        std::string text;
+        std::vector<uint8_t> codeMatches;
+    };
+
+    std::vector<Node> nodes;
+    size_t root = 0;
+};
+
+class Transaction {
+public:
+    std::vector<std::vector<std::string>> inserts;
+    std::vector<std::pair<size_t, std::vector<std::string>>> updates;  // (row index, new data)
+    std::vector<size_t> deletes;  // Row indices
+
+    void clear() {
+        inserts.clear();
+        updates.clear();
+        deletes.clear();
+    }
+};
+
+// Changes recorded in a write-ahead log record, in the order they were made
+enum class RedoOp : uint8_t {
+    RESET = 1,   // uint32 column count, then name and uint8 DataType per column; all rows removed
+    APPEND,      // uint32 cell count, then the cells
+    SET,         // uint64 row, uint32 column, value
+    ERASE,       // uint64 count, then the rows (ascending)
+    PERMUTE      // uint64 count, then new row i's old position for every i
+};
+
+// Fixed set of worker threads running one parallel loop at a time; the
+// calling thread works on the loop as well. A loop started from inside a
+// task runs inline on that thread.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency())) {
+        for (size_t i = 1; i < threads; ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Threads working on a loop, the caller included
+    size_t size() const { return workers.size() + 1; }
+
+    // Run fn(task) for every task in [0, count) and return once all are
+    // done. Threads claim tasks one at a time as they finish the previous
+    // one; maxThreads caps how many work on the loop (0 for all).
+    template <typename Fn>
+    void parallelFor(size_t count, Fn&& fn, size_t maxThreads = 0) {
+        if (count == 0) return;
+        size_t helpers = (maxThreads == 0) ? workers.size() : std::min(workers.size(), maxThreads - 1);
+        if (helpers == 0 || count == 1 || insideTask) {
+            for (size_t task = 0; task < count; ++task) fn(task);
+            return;
+        }
+
+        std::lock_guard<std::mutex> run(runMutex);
+        std::function<void(size_t)> task = std::ref(fn);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &task;
+            jobCount = count;
+            jobHelpers = helpers;
+            nextTask = 0;
+            joined = 0;
+            busyWorkers = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        runTasks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return busyWorkers == 0; });
+        job = nullptr;
+    }
+
+    // Pool shared by the parallel operators, one thread per core
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex runMutex;        // one loop at a time
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    size_t jobHelpers = 0;      // workers that take part in the loop
+    std::atomic<size_t> nextTask{0};
+    std::atomic<size_t> joined{0};
+    size_t busyWorkers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+    inline static thread_local bool insideTask = false;
+
+    void runTasks() {
+        insideTask = true;
+        for (size_t task; (task = nextTask.fetch_add(1)) < jobCount;) (*job)(task);
+        insideTask = false;
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            lock.unlock();
+            if (joined.fetch_add(1) < jobHelpers) runTasks();
+            lock.lock();
+            if (--busyWorkers == 0) finished.notify_one();
+        }
+    }
+};
+
+enum class JoinType {
+    INNER,
+    LEFT_OUTER
+};
+
+enum class JoinMethod {
+    AUTO,
+    HASH,
+    SORT_MERGE
+};
+
+enum class AggregateOp {
+    SUM, AVG, MIN, MAX, COUNT,
+    INVALID
+};
+
+AggregateOp parseAggregateOp(const std::string& function) {
+    if (function == "SUM") return AggregateOp::SUM;
+    if (function == "AVG" || function == "AVERAGE") return AggregateOp::AVG;
+    if (function == "MIN") return AggregateOp::MIN;
+    if (function == "MAX") return AggregateOp::MAX;
+    if (function == "COUNT") return AggregateOp::COUNT;
+    return AggregateOp::INVALID;
+}
+
+// Running SUM/AVG/MIN/MAX of the numeric cells seen so far
+struct AggregateState {
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    uint64_t count = 0;   // numeric cells
+
+    void add(double value) {
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        ++count;
+    }
+
+    void merge(const AggregateState& other) {
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        count += other.count;
+    }
+
+    // false when op needs a numeric cell and there were none
+    bool result(AggregateOp op, double& out) const {
+        if (count == 0) return false;
+        switch (op) {
+            case AggregateOp::SUM: out = sum; return true;
+            case AggregateOp::AVG: out = sum / count; return true;
+            case AggregateOp::MIN: out = min; return true;
+            case AggregateOp::MAX: out = max; return true;
+            default: return false;
+        }
+    }
+};
+
+// Milliseconds spent in each phase of one join
+struct JoinTimings {
+    double snapshot = 0;      // taking consistent copies of both inputs
+    double partition = 0;     // radix partitioning both inputs
+    double buildProbe = 0;    // building and probing the hash tables, or merging
+    double order = 0;         // putting the matches in output order
+    double materialize = 0;   // building the result rows
+    size_t partitions = 0;    // radix partitions; 0 when the join ran on one thread
+    size_t threads = 1;
+};
+
+// How scans (filterRows, selectRows, searchRowsCondition, ...) run
+struct ScanOptions {
+    size_t maxThreads = 0;   // threads a scan may use; 0 for one per core
+    bool ordered = true;     // return rows in table order
+};
+
+// Lock acquisitions on a table since it was created or the stats were reset
+struct LockStats {
+    uint64_t sharedAcquired = 0;      // table lock taken by readers and partition writers
+    uint64_t exclusiveAcquired = 0;   // table lock taken by writers that need the whole table
+    uint64_t partitionAcquired = 0;   // row partition locks
+    uint64_t contended = 0;           // acquisitions that had to wait
+    uint64_t waitNanoseconds = 0;     // time spent waiting in them
+};
+
+class Table {
+public:
+    class Cursor;       // query results read in batches
+    class JoinCursor;
+
+private:
+    std::string tableName;
+    std::vector<std::string> columns;
+    std::vector<DataType> columnTypes; // store data type of each column
+    std::vector<Column> data;          // column storage, parallel to columns
+    size_t rowCount = 0;
+
+    // Multi-column index for faster querying based on multiple columns. Rows
+    // are keyed by (ID, ""), each key holding its row positions in order.
+    std::unordered_map<std::tuple<std::string, std::string>, std::vector<size_t>, TupleHasher> multiColumnIndex;
+    bool inTransaction = false;
+    std::vector<std::vector<std::string>> transactionBackup;
+
+    // Locking. Readers take tableMutex shared plus every partition shared,
+    // only long enough to take a snapshot (or answer from an index), and
+    // scan with them released. Writers changing cells in place, without
+    // touching an index or a column-wide encoding, take tableMutex shared
+    // and just the partitions of their rows, so writers in different
+    // partitions run at once. Every other writer takes tableMutex
+    // exclusively. Locks are always taken table first, then partitions in
+    // ascending order.
+    static constexpr size_t LOCK_PARTITIONS = 16;
+    mutable std::shared_mutex tableMutex;
+    struct alignas(64) PartitionMutex {
+        std::shared_mutex mutex;  // one per cache line, so readers don't bounce each other's
+    };
+    mutable std::array<PartitionMutex, LOCK_PARTITIONS> partitionMutexes;
+
+    struct LockCounters {
+        std::atomic<uint64_t> sharedAcquired{0};
+        std::atomic<uint64_t> exclusiveAcquired{0};
+        std::atomic<uint64_t> partitionAcquired{0};
+        std::atomic<uint64_t> contended{0};
+        std::atomic<uint64_t> waitNanoseconds{0};
+    };
+    mutable LockCounters lockCounters;
+
+    // Shared hold on the table and all partitions: the rows cannot change
+    struct ReadLock {
+        std::shared_lock<std::shared_mutex> table;
+        std::array<std::shared_lock<std::shared_mutex>, LOCK_PARTITIONS> partitions;
+
+        void unlock() {
+            for (auto& partition : partitions) partition.unlock();
+            table.unlock();
+        }
+    };
+
+    std::vector<Index> indexes;
+
+    // Open transactions of beginTransaction, innermost last. They hold no
+    // rows, so they have their own mutex, never held with the table locks.
+    std::vector<Transaction> transactions;
+    std::mutex transactionMutex;
+
+    // Write-ahead log, once openLog has been called. The row helpers below
+    // record every change in redo; each public mutator ends by turning redo
+    // into one log record and waiting for it as durability demands.
+    std::unique_ptr<WriteAheadLog> wal;
+    std::atomic<Durability> durability{Durability::SYNCED};  // read by committers after unlocking
+    uint64_t logSequence = 0;     // last log record included in the rows
+    std::string redo;
+    bool replaying = false;
+
+    std::mutex logMutex;          // orders logSequence with appends to wal
+
+    bool logging() const { return wal && !replaying; }
+
+    static size_t partitionOf(size_t row) { return (row / BLOCK_ROWS) % LOCK_PARTITIONS; }
+
+    // Take lock, counting the acquisition and any wait for it
+    template <typename Lock>
+    void acquire(Lock& lock, std::atomic<uint64_t>& acquired) const {
+        acquired.fetch_add(1, std::memory_order_relaxed);
+        if (lock.try_lock()) return;
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        lockCounters.contended.fetch_add(1, std::memory_order_relaxed);
+        lockCounters.waitNanoseconds.fetch_add(static_cast<uint64_t>(waited.count()), std::memory_order_relaxed);
+    }
+
+    ReadLock readLock() const {
+        ReadLock lock;
+        lock.table = std::shared_lock<std::shared_mutex>(tableMutex, std::defer_lock);
+        acquire(lock.table, lockCounters.sharedAcquired);
+        for (size_t i = 0; i < LOCK_PARTITIONS; ++i) {
+            lock.partitions[i] = std::shared_lock<std::shared_mutex>(partitionMutexes[i].mutex, std::defer_lock);
+            acquire(lock.partitions[i], lockCounters.partitionAcquired);
+        }
+        return lock;
+    }
+
+    std::unique_lock<std::shared_mutex> writeLock() const {
+        std::unique_lock<std::shared_mutex> lock(tableMutex, std::defer_lock);
+        acquire(lock, lockCounters.exclusiveAcquired);
+        return lock;
+    }
+
+    // A snapshot is a read-only copy of the rows at one moment. It shares
+    // the column blocks with the live table, whose writers copy a block
+    // before changing it, so taking one costs a pointer per block and old
+    // block versions are freed when the last snapshot using them goes.
+    bool isSnapshot = false;
+    struct SnapshotTag {};
+
+    // Bytes of working memory sortTable and sortRows may use before they
+    // spill sorted runs to temporary files; 0 for no limit. See
+    // externalSortedOrder for what is counted.
+    size_t sortMemory = 0;
+
+    // Scans split the rows into morsels of this many rows (a multiple of
+    // BLOCK_ROWS) and hand them out to the threads of the shared pool
+    static constexpr size_t MORSEL_ROWS = 16 * BLOCK_ROWS;
+    ScanOptions scanOptions;
+
+    Table(const Table& source, SnapshotTag) {
+        tableName = source.tableName;
+        columns = source.columns;
+        columnTypes = source.columnTypes;
+        data = source.data;
+        rowCount = source.rowCount;
+        logSequence = source.logSequence;
+        scanOptions = source.scanOptions;
+        isSnapshot = true;
+    }
+
+    // Snapshot of the rows; the caller holds a ReadLock or the write lock
+    std::unique_ptr<Table> snapshotLocked() const {
+        return std::unique_ptr<Table>(new Table(*this, SnapshotTag{}));
+    }
+
+    // Rows matching plan for a reader holding lock, cut down to the output
+    // columns (see rowAt). An index lookup is done under the lock; a scan
+    // runs on a snapshot once the lock is released.
+    std::vector<std::vector<std::string>> readMatches(ReadLock& lock, const PredicatePlan& plan,
+                                                      const std::vector<size_t>& outputColumns = {}) {
+        std::vector<size_t> positions;
+        if (indexedMatches(plan, positions)) return materializeRows(positions, outputColumns);
+        if (isSnapshot) return scanMatches(plan, outputColumns);
+
+        std::unique_ptr<Table> view = snapshotLocked();
+        lock.unlock();
+        return view->scanMatches(plan, outputColumns);
+    }
+
+    // Cursor over the rows matching the plan compile() returns, with the
+    // columns of projection. The plan is
+    // compiled, any index lookup done and the snapshot taken under one read
+    // lock, so the plan's dictionary codes match the snapshot's.
+    // An unknown projection column gives an empty cursor.
+    template <typename Compile>
+    Cursor cursorFor(Compile&& compile, const std::vector<std::string>& projection) const {
+        Cursor cursor;
+        ReadLock lock = readLock();
+        cursor.rows = snapshotLocked();
+        if (!projectColumns(projection, cursor.outputColumns)) {
+            cursor.scanFrom = cursor.rows->rowCount;
+            return cursor;
+        }
+        cursor.plan = compile();
+        bool indexed = indexedMatches(cursor.plan, cursor.pending);
+        lock.unlock();
+        cursor.scanFrom = indexed ? cursor.rows->rowCount : 0;
+        return cursor;
+    }
+
+    // Recreate empty column storage from columns/columnTypes. Columns whose
+    // type is unchanged keep their encoding (e.g. dictionary encoding).
+    void resetStorage() {
+        if (columnTypes.size() != columns.size()) {
+            columnTypes.assign(columns.size(), DataType::STRING);
+        }
+        data.resize(columnTypes.size());
+        for (size_t i = 0; i < columnTypes.size(); ++i) {
+            if (data[i].getType() == columnTypes[i]) {
+                data[i].clear();
+            } else {
+                data[i] = Column(columnTypes[i]);
+            }
+        }
+        rowCount = 0;
+
+        for (auto& idx : indexes) {
+            size_t columnIndex = findColumnIndex(idx.column);
+            idx.indexMap.clear();
+            idx.typedTree.clear();
+            idx.textTree.clear();
+            idx.typedKeys = columnIndex != static_cast<size_t>(-1) && !data[columnIndex].isText();
+        }
+        multiColumnIndex.clear();
+
+        if (logging()) {
+            redo.push_back(static_cast<char>(RedoOp::RESET));
+            appendBytes(redo, static_cast<uint32_t>(columns.size()));
+            for (size_t i = 0; i < columns.size(); ++i) {
+                appendString(redo, columns[i]);
+                appendBytes(redo, static_cast<uint8_t>(columnTypes[i]));
+            }
+        }
+    }
+
+    size_t findColumnIndex(const std::string& columnName) const {
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i] == columnName) return i;
+        }
+        return static_cast<size_t>(-1);
+    }
+
+    // Materialize one row as text cells
+    std::vector<std::string> rowAt(size_t row) const {
+        std::vector<std::string> cells;
+        cells.reserve(data.size());
+        for (const auto& column : data) {
+            cells.push_back(column.get(row));
+        }
+        return cells;
+    }
+
+    // Cells of one row in the given output columns; every column when
+    // outputColumns is empty. Other columns are never read.
+    std::vector<std::string> rowAt(size_t row, const std::vector<size_t>& outputColumns) const {
+        if (outputColumns.empty()) return rowAt(row);
+        std::vector<std::string> cells;
+        cells.reserve(outputColumns.size());
+        for (size_t column : outputColumns) {
+            cells.push_back(data[column].get(row));
+        }
+        return cells;
+    }
+
+    // Column positions of a query's projection list, in the order given; an
+    // empty list (every column) gives no positions. False if a name is not
+    // a column.
+    bool projectColumns(const std::vector<std::string>& projection, std::vector<size_t>& outputColumns) const {
+        outputColumns.clear();
+        for (const auto& name : projection) {
+            size_t columnIndex = findColumnIndex(name);
+            if (columnIndex == static_cast<size_t>(-1)) {
+                std::cout << "Error: Column '" << name << "' not found." << std::endl;
+                return false;
+            }
+            outputColumns.push_back(columnIndex);
+        }
+        return true;
+    }
+
+    // All row changes go through appendRowData, setRowData/setCell,
+    // eraseRowData, permuteRowData and resetStorage, which keep the indexes
+    // and multiColumnIndex in step with the data.
+
+    static constexpr size_t NO_ROW = static_cast<size_t>(-1);
+
+    template <typename Map, typename Key>
+    static void addToBucket(Map& map, const Key& key, size_t row) {
+        auto& rows = map[key];
+        rows.insert(std::upper_bound(rows.begin(), rows.end(), row), row);
+    }
+
+    // Add (key, row) pairs whose rows are newer than any already in map.
+    // The pairs are sorted once; each distinct key is then looked up once
+    // and its rows appended to the end of its bucket, which keeps it sorted.
+    template <typename Map, typename Key>
+    static void appendToBuckets(Map& map, std::vector<std::pair<Key, size_t>> pairs) {
+        std::sort(pairs.begin(), pairs.end());
+        for (size_t i = 0; i < pairs.size();) {
+            size_t end = i + 1;
+            while (end < pairs.size() && pairs[end].first == pairs[i].first) ++end;
+            auto& rows = map[pairs[i].first];
+            rows.reserve(rows.size() + (end - i));
+            for (; i < end; ++i) rows.push_back(pairs[i].second);
+        }
+    }
+
+    template <typename Map, typename Key>
+    static void removeFromBucket(Map& map, const Key& key, size_t row) {
+        auto it = map.find(key);
+        if (it == map.end()) return;
+        auto& rows = it->second;
+        auto pos = std::lower_bound(rows.begin(), rows.end(), row);
+        if (pos != rows.end() && *pos == row) rows.erase(pos);
+        if (rows.empty()) map.erase(it);
+    }
+
+    // Renumber the rows in every bucket; rows mapped to NO_ROW are dropped
+    template <typename Map, typename Fn>
+    static void remapBuckets(Map& map, Fn&& newRow, bool keepsOrder) {
+        for (auto it = map.begin(); it != map.end();) {
+            auto& rows = it->second;
+            size_t kept = 0;
+            for (size_t row : rows) {
+                size_t mapped = newRow(row);
+                if (mapped != NO_ROW) rows[kept++] = mapped;
+            }
+            rows.resize(kept);
+            if (!keepsOrder) std::sort(rows.begin(), rows.end());
+            it = rows.empty() ? map.erase(it) : std::next(it);
+        }
+    }
+
+    // Fill an index from the column as it is stored now
+    void buildIndex(Index& idx, size_t columnIndex) {
+        const Column& column = data[columnIndex];
+        idx.indexMap.clear();
+        idx.typedTree.clear();
+        idx.textTree.clear();
+        if (idx.type == IndexType::BTREE) {
+            // Key by the typed value when the column stores one
+            idx.typedKeys = !column.isText();
+            if (idx.typedKeys) {
+                std::vector<BPlusTree<int64_t>::Entry> entries;
+                entries.reserve(rowCount);
+                for (size_t rowIdx = 0; rowIdx < rowCount; ++rowIdx) {
+                    entries.push_back({column.value(rowIdx), rowIdx});
+                }
+                idx.typedTree.build(std::move(entries));
+            } else {
+                std::vector<BPlusTree<std::string>::Entry> entries;
+                entries.reserve(rowCount);
+                for (size_t rowIdx = 0; rowIdx < rowCount; ++rowIdx) {
+                    entries.push_back({std::string(column.view(rowIdx)), rowIdx});
+                }
+                idx.textTree.build(std::move(entries));
+            }
+        } else {
+            // Populate the index map with column values and row indices
+            for (size_t rowIdx = 0; rowIdx < rowCount; ++rowIdx) {
+                idx.indexMap[column.get(rowIdx)].push_back(rowIdx);
+            }
+        }
+    }
+
+    void indexCell(Index& idx, size_t columnIndex, size_t row) {
+        const Column& column = data[columnIndex];
+        if (idx.type == IndexType::HASH) {
+            addToBucket(idx.indexMap, column.get(row), row);
+        } else if (idx.typedKeys && column.isText()) {
+            // The column just fell back to text storage; re-key the tree once
+            buildIndex(idx, columnIndex);
+        } else if (idx.typedKeys) {
+            idx.typedTree.insert(column.value(row), row);
+        } else {
+            idx.textTree.insert(std::string(column.view(row)), row);
+        }
+    }
+
+    void unindexCell(Index& idx, size_t columnIndex, size_t row) {
+        const Column& column = data[columnIndex];
+        if (idx.type == IndexType::HASH) {
+            removeFromBucket(idx.indexMap, column.get(row), row);
+        } else if (idx.typedKeys) {
+            idx.typedTree.erase(column.value(row), row);
+        } else {
+            idx.textTree.erase(std::string(column.view(row)), row);
+        }
+    }
+
+    void appendRowData(const std::vector<std::string>& rowData) {
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i].append(rowData[i]);
+        }
+        size_t row = rowCount++;
+
+        for (auto& idx : indexes) {
+            size_t columnIndex = findColumnIndex(idx.column);
+            if (columnIndex != static_cast<size_t>(-1)) indexCell(idx, columnIndex, row);
+        }
+        size_t idIndex = findColumnIndex("ID");
+        if (idIndex != static_cast<size_t>(-1)) {
+            addToBucket(multiColumnIndex, std::make_tuple(rowData[idIndex], std::string()), row);
+        }
+
+        if (logging()) {
+            redo.push_back(static_cast<char>(RedoOp::APPEND));
+            appendBytes(redo, static_cast<uint32_t>(data.size()));
+            for (size_t i = 0; i < data.size(); ++i) {
+                appendString(redo, rowData[i]);
+            }
+        }
+    }
+
+    void setCell(size_t row, size_t columnIndex, const std::string& value) {
+        bool isId = (columns[columnIndex] == "ID");
+        for (auto& idx : indexes) {
+            if (idx.column == columns[columnIndex]) unindexCell(idx, columnIndex, row);
+        }
+        if (isId) removeFromBucket(multiColumnIndex, std::make_tuple(data[columnIndex].get(row), std::string()), row);
+
+        data[columnIndex].set(row, value);
+
+        for (auto& idx : indexes) {
+            if (idx.column == columns[columnIndex]) indexCell(idx, columnIndex, row);
+        }
+        if (isId) addToBucket(multiColumnIndex, std::make_tuple(value, std::string()), row);
+
+        if (logging()) appendSetRecord(redo, row, columnIndex, value);
+    }
+
+    static void appendSetRecord(std::string& out, size_t row, size_t columnIndex, const std::string& value) {
+        out.push_back(static_cast<char>(RedoOp::SET));
+        appendBytes(out, static_cast<uint64_t>(row));
+        appendBytes(out, static_cast<uint32_t>(columnIndex));
+        appendString(out, value);
+    }
+
+    // Whether setting the cell to value only touches the block holding the
+    // row: no index or ID bucket to update and no change to the whole
+    // column (demotion to text, a new dictionary code). Cells that keep
+    // their value are left alone and always qualify.
+    bool updatesInPlace(size_t row, size_t columnIndex, const std::string& value) const {
+        if (data[columnIndex].equals(row, value)) return true;
+        if (columns[columnIndex] == "ID") return false;
+        for (const auto& idx : indexes) {
+            if (idx.column == columns[columnIndex]) return false;
+        }
+        return data[columnIndex].setsInPlace(value);
+    }
+
+    // Commit a transaction of in-place updates holding the table lock shared
+    // and only the partitions of its rows. Returns false, having changed
+    // nothing, when some update needs the whole table.
+    bool commitInPartitions(const Transaction& txn) {
+        std::shared_lock<std::shared_mutex> table(tableMutex, std::defer_lock);
+        acquire(table, lockCounters.sharedAcquired);
+
+        std::vector<size_t> touched;
+        for (const auto& update : txn.updates) {
+            if (update.first < rowCount) touched.push_back(partitionOf(update.first));
+        }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+        std::vector<std::unique_lock<std::shared_mutex>> partitions;
+        for (size_t partition : touched) {
+            partitions.emplace_back(partitionMutexes[partition].mutex, std::defer_lock);
+            acquire(partitions.back(), lockCounters.partitionAcquired);
+        }
+
+        // Check the cells with their partitions held, as another partition
+        // writer may have just changed them
+        for (const auto& [row, newData] : txn.updates) {
+            if (row >= rowCount) continue;
+            for (size_t i = 0; i < data.size() && i < newData.size(); ++i) {
+                if (!updatesInPlace(row, i, newData[i])) return false;
+            }
+        }
+
+        std::string changes;
+        for (const auto& [row, newData] : txn.updates) {
+            if (row >= rowCount) continue;
+            for (size_t i = 0; i < data.size() && i < newData.size(); ++i) {
+                if (data[i].equals(row, newData[i])) continue;
+                data[i].set(row, newData[i]);
+                if (wal) appendSetRecord(changes, row, i, newData[i]);
+            }
+        }
+        uint64_t logPosition = (wal && !changes.empty()) ? appendLogRecord(changes) : 0;
+
+        partitions.clear();
+        table.unlock();
+        if (waitForLog(logPosition)) {
+            std::cout << "Transaction committed." << std::endl;
+        }
+        return true;
+    }
+
+    void setRowData(size_t row, const std::vector<std::string>& rowData) {
+        for (size_t i = 0; i < data.size() && i < rowData.size(); ++i) {
+            setCell(row, i, rowData[i]);
+        }
+    }
+
+    // Remove rows given in ascending order without duplicates. Index entries
+    // of the erased rows are removed and every later row number shifts down
+    // by the number of erased rows before it.
+    void eraseRowData(const std::vector<size_t>& sortedRows) {
+        if (sortedRows.empty()) return;
+
+        if (logging()) {
+            redo.push_back(static_cast<char>(RedoOp::ERASE));
+            appendBytes(redo, static_cast<uint64_t>(sortedRows.size()));
+            for (size_t row : sortedRows) appendBytes(redo, static_cast<uint64_t>(row));
+        }
+
+        std::vector<size_t> newPosition(rowCount);
+        size_t erased = 0;
+        for (size_t row = 0; row < rowCount; ++row) {
+            if (erased < sortedRows.size() && sortedRows[erased] == row) {
+                newPosition[row] = NO_ROW;
+                ++erased;
+            } else {
+                newPosition[row] = row - erased;
+            }
+        }
+        auto survivor = [&](size_t row) { return newPosition[row]; };
+        // B+tree separators may still name an erased row; it maps to where
+        // the next surviving row lands, which keeps the tree ordered
+        auto shifted = [&](size_t row) {
+            if (newPosition[row] != NO_ROW) return newPosition[row];
+            return row - static_cast<size_t>(std::lower_bound(sortedRows.begin(), sortedRows.end(), row) - sortedRows.begin());
+        };
+
+        for (auto& idx : indexes) {
+            size_t columnIndex = findColumnIndex(idx.column);
+            if (columnIndex == static_cast<size_t>(-1)) continue;
+            if (idx.type == IndexType::HASH) {
+                remapBuckets(idx.indexMap, survivor, true);
+                continue;
+            }
+            for (size_t row : sortedRows) {
+                unindexCell(idx, columnIndex, row);
+            }
+            if (idx.typedKeys) idx.typedTree.relabelRows(shifted);
+            else idx.textTree.relabelRows(shifted);
+        }
+        remapBuckets(multiColumnIndex, survivor, true);
+
+        for (auto& column : data) {
+            column.erase(sortedRows);
+        }
+        rowCount -= sortedRows.size();
+    }
+
+    // Reorder rows so that new row i holds old row order[i]
+    void permuteRowData(const std::vector<size_t>& order) {
+        for (auto& column : data) {
+            column.permute(order);
+        }
+
+        if (logging()) {
+            redo.push_back(static_cast<char>(RedoOp::PERMUTE));
+            appendBytes(redo, static_cast<uint64_t>(order.size()));
+            for (size_t row : order) appendBytes(redo, static_cast<uint64_t>(row));
+        }
+
+        std::vector<size_t> newPosition(order.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            newPosition[order[i]] = i;
+        }
+        auto moved = [&](size_t row) { return newPosition[row]; };
+        for (auto& idx : indexes) {
+            if (idx.type == IndexType::HASH) remapBuckets(idx.indexMap, moved, false);
+            else if (idx.typedKeys) idx.typedTree.remapRows(moved);
+            else idx.textTree.remapRows(moved);
+        }
+        remapBuckets(multiColumnIndex, moved, false);
+    }
+
+    // Streaming hash aggregation over the rows it is fed. Memory is one
+    // entry per group: its key, one of its rows (to print the key cells
+    // from) and a running AggregateState per aggregated column. A single
+    // typed or dictionary group column is keyed by its int64 value or code;
+    // anything else by the group columns' stored values packed into a string.
+    struct GroupAggregator {
+        const Table& table;
+        std::vector<size_t> keyColumns;
+        std::vector<size_t> valueColumns;   // distinct aggregated columns
+        bool valueKeys;
+
+        std::unordered_map<int64_t, size_t> valueGroups;
+        std::unordered_map<std::string, size_t> packedGroups;
+        std::vector<size_t> firstRows;      // per group
+        std::vector<uint64_t> rowCounts;    // per group
+        std::vector<AggregateState> states; // group g, value column v at g * valueColumns.size() + v
+        std::string packed;                 // key of the current row
+
+        GroupAggregator(const Table& source, std::vector<size_t> keys, std::vector<size_t> values)
+            : table(source), keyColumns(std::move(keys)), valueColumns(std::move(values)) {
+            valueKeys = keyColumns.size() == 1 &&
+                        (!table.data[keyColumns[0]].isText() || table.data[keyColumns[0]].isDictionary());
+        }
+
+        size_t groups() const { return firstRows.size(); }
+
+        const AggregateState& state(size_t group, size_t value) const {
+            return states[group * valueColumns.size() + value];
+        }
+
+        // Group number of row, adding a group the first time its key is seen
+        size_t groupOf(size_t row) {
+            size_t next = firstRows.size();
+            if (valueKeys) {
+                const Column& column = table.data[keyColumns[0]];
+                int64_t key = column.isDictionary() ? column.code(row) : column.value(row);
+                auto [it, inserted] = valueGroups.try_emplace(key, next);
+                if (!inserted) return it->second;
+            } else {
+                packKey(row, packed);
+                auto it = packedGroups.find(packed);
+                if (it != packedGroups.end()) return it->second;
+                packedGroups.emplace(packed, next);
+            }
+            firstRows.push_back(row);
+            rowCounts.push_back(0);
+            states.resize(states.size() + valueColumns.size());
+            return next;
+        }
+
+        void packKey(size_t row, std::string& out) const {
+            out.clear();
+            for (size_t columnIndex : keyColumns) {
+                const Column& column = table.data[columnIndex];
+                if (column.isDictionary()) {
+                    appendBytes(out, column.code(row));
+                } else if (!column.isText()) {
+                    appendBytes(out, column.value(row));
+                } else {
+                    appendString(out, column.view(row));
+                }
+            }
+        }
+
+        // Hash of a row's group key, for splitting groups by key
+        uint64_t keyHash(size_t row) {
+            if (valueKeys) {
+                const Column& column = table.data[keyColumns[0]];
+                return joinHash(column.isDictionary() ? column.code(row) : column.value(row));
+            }
+            packKey(row, packed);
+            return joinHash(std::string_view(packed));
+        }
+
+        // Fold group of another aggregator over the same rows into ours
+        void mergeGroup(const GroupAggregator& other, size_t group) {
+            size_t into = groupOf(other.firstRows[group]);
+            rowCounts[into] += other.rowCounts[group];
+            for (size_t v = 0; v < valueColumns.size(); ++v) {
+                states[into * valueColumns.size() + v].merge(other.state(group, v));
+            }
+        }
+
+        // Add group of another aggregator as a new group, without a key
+        // lookup; for aggregators holding disjoint groups
+        void appendGroup(const GroupAggregator& other, size_t group) {
+            firstRows.push_back(other.firstRows[group]);
+            rowCounts.push_back(other.rowCounts[group]);
+            auto first = other.states.begin() + group * valueColumns.size();
+            states.insert(states.end(), first, first + valueColumns.size());
+        }
+
+        void consume(size_t begin, size_t end) {
+            for (size_t row = begin; row < end; ++row) {
+                size_t group = groupOf(row);
+                rowCounts[group]++;
+                AggregateState* groupStates = states.data() + group * valueColumns.size();
+                for (size_t v = 0; v < valueColumns.size(); ++v) {
+                    double value;
+                    if (table.numericCell(valueColumns[v], row, value)) groupStates[v].add(value);
+                }
+            }
+        }
+    };
+
+    // Cell of a group's key-th group column
+    std::string groupCell(const GroupAggregator& aggregator, size_t group, size_t key) const {
+        return data[aggregator.keyColumns[key]].get(aggregator.firstRows[group]);
+    }
+
+    // Smaller grouped queries run on one thread
+    static constexpr size_t PARALLEL_AGGREGATE_ROWS = 1 << 16;
+
+    // Resolve the columns of a grouped query and run it over every row,
+    // in parallel for large tables. aggregateSlots[i] is where aggregates[i]'s column sits in
+    // valueColumns. Throws on unknown columns or functions.
+    GroupAggregator aggregateGroups(const std::vector<std::string>& groupColumns, const std::vector<Aggregate>& aggregates,
+                                    std::vector<AggregateOp>& ops, std::vector<size_t>& aggregateSlots) const {
+        std::vector<size_t> keyColumns, valueColumns;
+        for (const auto& name : groupColumns) {
+            size_t columnIndex = findColumnIndex(name);
+            if (columnIndex == static_cast<size_t>(-1)) throw std::runtime_error("Group column '" + name + "' not found.");
+            keyColumns.push_back(columnIndex);
+        }
+        for (const auto& aggregate : aggregates) {
+            size_t columnIndex = findColumnIndex(aggregate.column);
+            if (columnIndex == static_cast<size_t>(-1)) throw std::runtime_error("Aggregate column '" + aggregate.column + "' not found.");
+            AggregateOp op = parseAggregateOp(aggregate.function);
+            if (op == AggregateOp::INVALID) throw std::runtime_error("Unsupported aggregate function: " + aggregate.function);
+            ops.push_back(op);
+            auto slot = std::find(valueColumns.begin(), valueColumns.end(), columnIndex);
+            aggregateSlots.push_back(std::distance(valueColumns.begin(), slot));
+            if (slot == valueColumns.end()) valueColumns.push_back(columnIndex);
+        }
+
+        GroupAggregator aggregator(*this, std::move(keyColumns), std::move(valueColumns));
+        ThreadPool& pool = ThreadPool::shared();
+        size_t threads = scanOptions.maxThreads == 0 ? pool.size() : std::min(pool.size(), scanOptions.maxThreads);
+        if (rowCount < PARALLEL_AGGREGATE_ROWS || threads < 2) {
+            aggregator.consume(0, rowCount);
+            return aggregator;
+        }
+
+        // Each thread aggregates one slice of the rows into its own table,
+        // then sorts its groups into partitions by key hash
+        size_t slices = threads, partitions = threads;
+        size_t sliceRows = (rowCount + slices - 1) / slices;
+        std::vector<GroupAggregator> partials(slices, aggregator);
+        std::vector<std::vector<std::vector<size_t>>> buckets(slices, std::vector<std::vector<size_t>>(partitions));
+        pool.parallelFor(slices, [&](size_t slice) {
+            GroupAggregator& partial = partials[slice];
+            partial.consume(std::min(rowCount, slice * sliceRows), std::min(rowCount, (slice + 1) * sliceRows));
+            for (size_t group = 0; group < partial.groups(); ++group) {
+                buckets[slice][partial.keyHash(partial.firstRows[group]) % partitions].push_back(group);
+            }
+        }, threads);
+
+        // Merge each partition on its own thread. A key lands in one
+        // partition only; slices are merged in row order, so every group
+        // keeps its first row.
+        std::vector<GroupAggregator> merged(partitions, aggregator);
+        pool.parallelFor(partitions, [&](size_t partition) {
+            for (size_t slice = 0; slice < slices; ++slice) {
+                for (size_t group : buckets[slice][partition]) merged[partition].mergeGroup(partials[slice], group);
+            }
+        }, threads);
+        partials.clear();
+
+        // Gather the groups in order of first appearance
+        std::vector<std::tuple<size_t, size_t, size_t>> order;  // (first row, partition, group)
+        for (size_t partition = 0; partition < partitions; ++partition) {
+            for (size_t group = 0; group < merged[partition].groups(); ++group) {
+                order.emplace_back(merged[partition].firstRows[group], partition, group);
+            }
+        }
+        std::sort(order.begin(), order.end());
+        for (const auto& [row, partition, group] : order) aggregator.appendGroup(merged[partition], group);
+        return aggregator;
+    }
+
+    // Numeric value of a cell, read the way std::stod reads its text: a
+    // typed INTEGER is its value, a typed DATE its year, and text is parsed
+    // in place without allocating or throwing
+    bool numericCell(size_t columnIndex, size_t row, double& out) const {
+        const Column& column = data[columnIndex];
+        if (column.isText()) return parseLeadingNumber(column.view(row), out);
+        if (column.getType() == DataType::INTEGER) {
+            out = static_cast<double>(column.value(row));
+            return true;
+        }
+        int64_t year;
+        unsigned month, day;
+        civilFromDays(column.value(row), year, month, day);
+        out = static_cast<double>(year);
+        return true;
+    }
+
+    // Compare two rows by the given columns: <0, 0 or >0. Typed columns
+    // compare their stored values, so INTEGER and DATE columns sort by value.
+    int comparePositions(size_t a, size_t b, const std::vector<size_t>& columnIndices,
+                         const std::vector<bool>& ascendingFlags) const {
+        for (size_t i = 0; i < columnIndices.size(); ++i) {
+            const Column& column = data[columnIndices[i]];
+            int cmp;
+            if (column.isText()) {
+                cmp = column.view(a).compare(column.view(b));
+            } else {
+                cmp = (column.value(a) < column.value(b)) ? -1 : (column.value(a) > column.value(b) ? 1 : 0);
+            }
+            if (cmp != 0) {
+                return ascendingFlags[i] ? cmp : -cmp;
+            }
+        }
+        return 0;
+    }
+
+    // Stable-sort row positions by the given columns
+    void sortPositions(std::vector<size_t>::iterator first, std::vector<size_t>::iterator last,
+                       const std::vector<size_t>& columnIndices, const std::vector<bool>& ascendingFlags) const {
+        std::stable_sort(first, last, [&](size_t a, size_t b) {
+            return comparePositions(a, b, columnIndices, ascendingFlags) < 0;  // equal rows keep their order
+        });
+    }
+
+    // The first k rows of the plan's matches in the order sortPositions
+    // gives them, found without sorting every match. Each morsel keeps its
+    // best k rows in a max-heap, replacing the heap's worst row whenever a
+    // better one turns up, and the morsel heaps are merged the same way.
+    // Ties go to the earlier row, as in a stable sort.
+    std::vector<size_t> topPositions(const PredicatePlan& plan, size_t k, const std::vector<size_t>& columnIndices,
+                                     const std::vector<bool>& ascendingFlags) const {
+        auto less = [&](size_t a, size_t b) {
+            int cmp = comparePositions(a, b, columnIndices, ascendingFlags);
+            return cmp != 0 ? cmp < 0 : a < b;
+        };
+        auto offer = [&](std::vector<size_t>& heap, size_t row) {
+            if (heap.size() < k) {
+                heap.push_back(row);
+                std::push_heap(heap.begin(), heap.end(), less);
+            } else if (less(row, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), less);
+                heap.back() = row;
+                std::push_heap(heap.begin(), heap.end(), less);
+            }
+        };
+
+        std::vector<size_t> top;
+        if (k == 0) return top;
+        std::vector<size_t> candidates;
+        if (indexedMatches(plan, candidates)) {
+            for (size_t row : candidates) offer(top, row);
+        } else {
+            std::mutex topMutex;
+            forEachMorsel([&](size_t begin, size_t end) {
+                std::vector<size_t> heap;
+                morselBitmap(plan, begin, end).forEach([&](size_t row) { offer(heap, begin + row); });
+                std::lock_guard<std::mutex> lock(topMutex);
+                for (size_t row : heap) offer(top, row);
+            });
+        }
+        std::sort_heap(top.begin(), top.end(), less);
+        return top;
+    }
+
+    // Row order that sorts the whole table by the given columns
+    std::vector<size_t> sortedOrder(const std::vector<size_t>& columnIndices, const std::vector<bool>& ascendingFlags) const {
+        return sortedRange(0, rowCount, columnIndices, ascendingFlags);
+    }
+
+    // Rank of each dictionary code in the sorted dictionary, so codes sort
+    // the way their text does
+    static std::vector<uint32_t> dictionaryRanks(const Column& column) {
+        const std::vector<std::string>& values = column.getDictionary();
+        std::vector<uint32_t> byValue(values.size());
+        std::iota(byValue.begin(), byValue.end(), 0);
+        std::sort(byValue.begin(), byValue.end(), [&](uint32_t a, uint32_t b) { return values[a] < values[b]; });
+        std::vector<uint32_t> ranks(values.size());
+        for (uint32_t rank = 0; rank < byValue.size(); ++rank) ranks[byValue[rank]] = rank;
+        return ranks;
+    }
+
+    // Rows [begin, end) in the order sortPositions gives them. Each row gets
+    // a normalized key: its sort columns encoded so that comparing keys
+    // compares the rows, descending columns bit-inverted. Typed columns
+    // give 8 bytes (the value with its sign bit flipped) and dictionary
+    // columns 4 (the code's rank); up to 16 such bytes are sorted with an
+    // LSD radix sort on the row order. Longer keys, and text columns
+    // (escaped bytes, 0x00 0x00 terminated), are sorted with memcmp.
+    std::vector<size_t> sortedRange(size_t begin, size_t end, const std::vector<size_t>& columnIndices,
+                                    const std::vector<bool>& ascendingFlags) const {
+        std::vector<std::vector<uint32_t>> ranks(columnIndices.size());
+        size_t width = 0;
+        bool fixedWidth = true;
+        for (size_t i = 0; i < columnIndices.size(); ++i) {
+            const Column& column = data[columnIndices[i]];
+            if (column.isDictionary()) {
+                ranks[i] = dictionaryRanks(column);
+                width += 4;
+            } else if (!column.isText()) {
+                width += 8;
+            } else {
+                fixedWidth = false;
+            }
+        }
+        if (fixedWidth && width <= 16) return radixSortedRange(begin, end, columnIndices, ascendingFlags, ranks, width);
+
+        // memcmp sort: all keys in one buffer
+        std::string keys;
+        std::vector<size_t> offsets(end - begin + 1, 0);
+        for (size_t row = begin; row < end; ++row) {
+            for (size_t i = 0; i < columnIndices.size(); ++i) {
+                const Column& column = data[columnIndices[i]];
+                size_t start = keys.size();
+                if (column.isDictionary()) {
+                    uint32_t rank = ranks[i][column.code(row)];
+                    for (int shift = 24; shift >= 0; shift -= 8) keys.push_back(static_cast<char>(rank >> shift));
+                } else if (!column.isText()) {
+                    uint64_t value = static_cast<uint64_t>(column.value(row)) ^ (uint64_t(1) << 63);
+                    for (int shift = 56; shift >= 0; shift -= 8) keys.push_back(static_cast<char>(value >> shift));
+                } else {
+                    for (char c : column.view(row)) {
+                        keys.push_back(c);
+                        if (c == '\0') keys.push_back('\xFF');
+                    }
+                    keys.append(2, '\0');
+                }
+                if (!ascendingFlags[i]) {
+                    for (size_t k = start; k < keys.size(); ++k) keys[k] = static_cast<char>(~keys[k]);
+                }
+            }
+            offsets[row - begin + 1] = keys.size();
+        }
+
+        std::vector<size_t> order(end - begin);
+        std::iota(order.begin(), order.end(), begin);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            const char* keyA = keys.data() + offsets[a - begin];
+            const char* keyB = keys.data() + offsets[b - begin];
+            size_t lengthA = offsets[a - begin + 1] - offsets[a - begin];
+            size_t lengthB = offsets[b - begin + 1] - offsets[b - begin];
+            int cmp = std::memcmp(keyA, keyB, std::min(lengthA, lengthB));
+            return cmp != 0 ? cmp < 0 : lengthA < lengthB;
+        });
+        return order;
+    }
+
+    // sortedRange for keys of at most 16 bytes, held as a 128-bit number
+    // in two words. One pass counts every byte position; positions where
+    // all rows share a byte are skipped.
+    std::vector<size_t> radixSortedRange(size_t begin, size_t end, const std::vector<size_t>& columnIndices,
+                                         const std::vector<bool>& ascendingFlags,
+                                         const std::vector<std::vector<uint32_t>>& ranks, size_t width) const {
+        struct Record {
+            uint64_t high = 0, low = 0;
+            size_t row;
+        };
+        size_t count = end - begin;
+        std::vector<Record> records(count);
+        for (size_t row = begin; row < end; ++row) {
+            Record& record = records[row - begin];
+            record.row = row;
+            for (size_t i = 0; i < columnIndices.size(); ++i) {
+                const Column& column = data[columnIndices[i]];
+                uint64_t key;
+                unsigned bits;
+                if (column.isDictionary()) {
+                    key = ranks[i][column.code(row)];
+                    bits = 32;
+                    if (!ascendingFlags[i]) key = ~key & 0xFFFFFFFFu;
+                } else {
+                    key = static_cast<uint64_t>(column.value(row)) ^ (uint64_t(1) << 63);
+                    bits = 64;
+                    if (!ascendingFlags[i]) key = ~key;
+                }
+                record.high = (bits == 64) ? record.low : (record.high << bits) | (record.low >> (64 - bits));
+                record.low = (bits == 64) ? key : (record.low << bits) | key;
+            }
+        }
+
+        auto byteAt = [](const Record& record, size_t position) {  // position 0 is the least significant
+            uint64_t word = position < 8 ? record.low : record.high;
+            return static_cast<uint8_t>(word >> (8 * (position % 8)));
+        };
+        std::vector<std::array<size_t, 256>> histograms(width);
+        for (auto& histogram : histograms) histogram.fill(0);
+        for (const Record& record : records) {
+            for (size_t position = 0; position < width; ++position) histograms[position][byteAt(record, position)]++;
+        }
+
+        std::vector<Record> scratch(count);
+        for (size_t position = 0; position < width; ++position) {
+            auto& histogram = histograms[position];
+            if (std::find(histogram.begin(), histogram.end(), count) != histogram.end()) continue;
+            size_t offset = 0;
+            for (size_t& bucket : histogram) {
+                size_t rows = bucket;
+                bucket = offset;
+                offset += rows;
+            }
+            for (const Record& record : records) scratch[histogram[byteAt(record, position)]++] = record;
+            records.swap(scratch);
+        }
+
+        std::vector<size_t> order(count);
+        for (size_t i = 0; i < count; ++i) order[i] = records[i].row;
+        return order;
+    }
+
+    // Bytes sortedRange needs per row it sorts, the order it returns
+    // included: two 24-byte records (keys and scratch) for a radix sort;
+    // otherwise the normalized key (text columns at their average stored
+    // length), its offset and stable_sort's buffer
+    size_t sortRowBytes(const std::vector<size_t>& columnIndices) const {
+        size_t keyBytes = 0;
+        bool fixedWidth = true;
+        for (size_t columnIndex : columnIndices) {
+            const Column& column = data[columnIndex];
+            if (column.isDictionary()) {
+                keyBytes += 4;
+            } else if (!column.isText()) {
+                keyBytes += 8;
+            } else {
+                fixedWidth = false;
+                keyBytes += column.storageBytes() / std::max<size_t>(1, rowCount) + 2;
+            }
+        }
+        if (fixedWidth && keyBytes <= 16) return 2 * (2 * sizeof(uint64_t) + sizeof(size_t)) + sizeof(size_t);
+        return keyBytes + 3 * sizeof(size_t);
+    }
+
+    // sortedOrder within sortMemory bytes of working memory. The budget
+    // first covers what applying the order needs: the order itself, the
+    // inverse permutation permuteRowData builds and its copy of the largest
+    // column. Runs of rows whose sortRowBytes fit in the rest are sorted
+    // and written to temporary files, then merged k ways through a heap,
+    // reading each run through a buffer that is an equal share of it.
+    std::vector<size_t> externalSortedOrder(const std::vector<size_t>& columnIndices, const std::vector<bool>& ascendingFlags) const {
+        using TempFile = std::unique_ptr<FILE, int (*)(FILE*)>;
+        if (sortMemory == 0) return sortedOrder(columnIndices, ascendingFlags);
+        size_t reserved = 2 * sizeof(size_t) * rowCount;
+        size_t largestColumn = 0;
+        for (const auto& column : data) largestColumn = std::max(largestColumn, column.storageBytes());
+        reserved += largestColumn;
+        size_t budget = sortMemory > reserved ? sortMemory - reserved : 0;
+        size_t runRows = std::max<size_t>(1024, budget / sortRowBytes(columnIndices));
+        if (rowCount <= runRows) return sortedOrder(columnIndices, ascendingFlags);
+
+        // Sort each run and spill it, a buffer at a time
+        std::vector<TempFile> runs;
+        std::vector<size_t> run;
+        std::vector<uint64_t> buffer;
+        for (size_t start = 0; start < rowCount; start += runRows) {
+            run = sortedRange(start, std::min(rowCount, start + runRows), columnIndices, ascendingFlags);
+
+            TempFile file(std::tmpfile(), &std::fclose);
+            bool written = static_cast<bool>(file);
+            for (size_t at = 0; written && at < run.size(); at += 1024) {
+                buffer.assign(run.begin() + at, run.begin() + std::min(run.size(), at + 1024));
+                written = std::fwrite(buffer.data(), sizeof(uint64_t), buffer.size(), file.get()) == buffer.size();
+            }
+            if (!written) {
+                std::cout << "Warning: Cannot spill sort run, sorting in memory." << std::endl;
+                return sortedOrder(columnIndices, ascendingFlags);
+            }
+            std::rewind(file.get());
+            runs.push_back(std::move(file));
+        }
+        run = std::vector<size_t>();
+
+        // Merge. Runs hold ascending ranges of rows and each is stably
+        // sorted, so breaking ties by position keeps the sort stable.
+        struct RunReader {
+            FILE* file;
+            std::vector<uint64_t> rows;
+            size_t next = 0;
+
+            bool fill() {
+                rows.resize(rows.capacity());
+                rows.resize(std::fread(rows.data(), sizeof(uint64_t), rows.size(), file));
+                next = 0;
+                return !rows.empty();
+            }
+        };
+        size_t bufferRows = std::max<size_t>(256, budget / sizeof(uint64_t) / runs.size());
+        std::vector<RunReader> readers(runs.size());
+        auto after = [&](size_t a, size_t b) {  // heap order: a comes out after b
+            size_t rowA = readers[a].rows[readers[a].next], rowB = readers[b].rows[readers[b].next];
+            int cmp = comparePositions(rowA, rowB, columnIndices, ascendingFlags);
+            return cmp != 0 ? cmp > 0 : rowA > rowB;
+        };
+        std::vector<size_t> heap;
+        for (size_t i = 0; i < runs.size(); ++i) {
+            readers[i].file = runs[i].get();
+            readers[i].rows.reserve(bufferRows);
+            if (readers[i].fill()) heap.push_back(i);
+        }
+        std::make_heap(heap.begin(), heap.end(), after);
+
+        std::vector<size_t> order;
+        order.reserve(rowCount);
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), after);
+            RunReader& reader = readers[heap.back()];
+            order.push_back(reader.rows[reader.next++]);
+            if (reader.next < reader.rows.size() || reader.fill()) {
+                std::push_heap(heap.begin(), heap.end(), after);
+            } else {
+                heap.pop_back();
+            }
+        }
+        return order;
+    }
+
+    // One side of a join: a snapshot of the table and the row order of a
+    // B+tree index on the join column, taken together under the read lock
+    struct JoinInput {
+        std::unique_ptr<Table> rows;
+        size_t column = NO_ROW;
+        std::vector<size_t> order;   // rows in key order, once known
+        bool indexTyped = false;     // order came from a tree keyed by int64
+        bool hasIndexOrder = false;
+
+        // Whether the rows are available in key order without sorting
+        bool keyOrder(bool typedKeys) {
+            if (hasIndexOrder && indexTyped == typedKeys) return true;
+            hasIndexOrder = false;
+            order.clear();
+            const Column& keys = rows->data[column];
+            for (size_t row = 1; row < rows->rowCount; ++row) {
+                bool descending = typedKeys ? keys.value(row) < keys.value(row - 1) : keys.view(row) < keys.view(row - 1);
+                if (descending) return false;
+            }
+            order.resize(rows->rowCount);
+            std::iota(order.begin(), order.end(), 0);
+            return true;
+        }
+
+        void sortByKey() {
+            if (order.size() == rows->rowCount) return;
+            order = rows->sortedOrder({column}, {true});
+        }
+    };
+
+    JoinInput joinInput(const std::string& columnName) const {
+        JoinInput input;
+        ReadLock lock = readLock();
+        input.column = findColumnIndex(columnName);
+        if (input.column == NO_ROW) return input;
+
+        if (const Index* tree = findUsableIndex(input.column, IndexType::BTREE)) {
+            input.order.reserve(rowCount);
+            input.indexTyped = tree->typedKeys;
+            input.hasIndexOrder = true;
+            auto collect = [&](const auto& entry) { input.order.push_back(entry.row); };
+            if (tree->typedKeys) {
+                tree->typedTree.forEach(true, collect);
+            } else {
+                tree->textTree.forEach(true, collect);
+            }
+        }
+        input.rows = snapshotLocked();
+        return input;
+    }
+
+    // Join rows of a build and a probe input by key. Build rows sharing a
+    // key are chained through next in ascending order; matches are
+    // appended as (probe row, build row) in probe order.
+    template <typename Key, typename BuildKey, typename ProbeKey>
+    static void hashJoin(size_t buildCount, BuildKey buildKey, size_t probeCount, ProbeKey probeKey,
+                         std::vector<std::pair<size_t, size_t>>& matches) {
+        std::unordered_map<Key, size_t> heads;
+        heads.reserve(buildCount);
+        std::vector<size_t> next(buildCount, NO_ROW);
+        for (size_t row = buildCount; row-- > 0;) {
+            auto [it, inserted] = heads.try_emplace(buildKey(row), row);
+            if (!inserted) {
+                next[row] = it->second;
+                it->second = row;
+            }
+        }
+
+        for (size_t row = 0; row < probeCount; ++row) {
+            auto it = heads.find(probeKey(row));
+            if (it == heads.end()) continue;
+            for (size_t match = it->second; match != NO_ROW; match = next[match]) {
+                matches.emplace_back(row, match);
+            }
+        }
+    }
+
+    // Smaller joins run on one thread with hashJoin
+    static constexpr size_t PARALLEL_JOIN_ROWS = 1 << 16;
+    // Build rows per radix partition, so that a partition's hash table
+    // stays in cache
+    static constexpr size_t JOIN_PARTITION_ROWS = 8192;
+
+    static uint64_t joinHash(int64_t key) {
+        uint64_t h = static_cast<uint64_t>(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    }
+
+    static uint64_t joinHash(std::string_view key) {
+        return joinHash(static_cast<int64_t>(std::hash<std::string_view>()(key)));
+    }
+
+    struct HashedRow {
+        uint64_t hash;
+        size_t row;
+    };
+
+    // Scatter rows [0, count) into 2^bits partitions by the top bits of
+    // their key hash. Each partition keeps its rows in ascending order;
+    // partition p is out[bounds[p], bounds[p + 1]).
+    template <typename KeyOf>
+    static void radixPartition(size_t count, KeyOf keyOf, unsigned bits, ThreadPool& pool,
+                               std::vector<HashedRow>& out, std::vector<size_t>& bounds) {
+        size_t partitions = size_t(1) << bits;
+        size_t chunks = std::min<size_t>(pool.size() * 4, std::max<size_t>(1, count / 4096));
+        size_t chunkRows = (count + chunks - 1) / chunks;
+        auto partitionOf = [bits](uint64_t hash) { return bits == 0 ? 0 : static_cast<size_t>(hash >> (64 - bits)); };
+
+        // Pass 1: hash every row and count each chunk's rows per partition
+        std::vector<uint64_t> hashes(count);
+        std::vector<size_t> histogram(chunks * partitions, 0);
+        pool.parallelFor(chunks, [&](size_t chunk) {
+            size_t* counts = &histogram[chunk * partitions];
+            size_t end = std::min(count, (chunk + 1) * chunkRows);
+            for (size_t row = chunk * chunkRows; row < end; ++row) {
+                hashes[row] = joinHash(keyOf(row));
+                counts[partitionOf(hashes[row])]++;
+            }
+        });
+
+        // Where each chunk's rows of each partition start
+        bounds.assign(partitions + 1, 0);
+        size_t offset = 0;
+        for (size_t p = 0; p < partitions; ++p) {
+            bounds[p] = offset;
+            for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                size_t rows = histogram[chunk * partitions + p];
+                histogram[chunk * partitions + p] = offset;
+                offset += rows;
+            }
+        }
+        bounds[partitions] = offset;
+
+        // Pass 2: scatter
+        out.resize(count);
+        pool.parallelFor(chunks, [&](size_t chunk) {
+            size_t* cursor = &histogram[chunk * partitions];
+            size_t end = std::min(count, (chunk + 1) * chunkRows);
+            for (size_t row = chunk * chunkRows; row < end; ++row) {
+                out[cursor[partitionOf(hashes[row])]++] = {hashes[row], row};
+            }
+        });
+    }
+
+    // hashJoin for large inputs: both sides are radix partitioned by key
+    // hash, then the partitions are built and probed in parallel on the
+    // shared thread pool. Produces the same matches in the same order.
+    template <typename BuildKey, typename ProbeKey>
+    static void radixHashJoin(size_t buildCount, BuildKey buildKey, size_t probeCount, ProbeKey probeKey,
+                              std::vector<std::pair<size_t, size_t>>& matches, JoinTimings& timings) {
+        using Clock = std::chrono::steady_clock;
+        auto millisSince = [](Clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+        ThreadPool& pool = ThreadPool::shared();
+
+        unsigned bits = 0;
+        while (bits < 14 && ((buildCount >> bits) > JOIN_PARTITION_ROWS || (size_t(1) << bits) < pool.size() * 4)) ++bits;
+        size_t partitions = size_t(1) << bits;
+        timings.partitions = partitions;
+        timings.threads = pool.size();
+
+        auto start = Clock::now();
+        std::vector<HashedRow> build, probe;
+        std::vector<size_t> buildBounds, probeBounds;
+        radixPartition(buildCount, buildKey, bits, pool, build, buildBounds);
+        radixPartition(probeCount, probeKey, bits, pool, probe, probeBounds);
+        timings.partition += millisSince(start);
+
+        // Build and probe each partition. The table is open addressing over
+        // the partition's distinct keys; each slot heads a chain of build
+        // rows with that key in ascending order.
+        start = Clock::now();
+        std::vector<std::vector<std::pair<size_t, size_t>>> found(partitions);
+        pool.parallelFor(partitions, [&](size_t p) {
+            const HashedRow* buildRows = build.data() + buildBounds[p];
+            size_t buildSize = buildBounds[p + 1] - buildBounds[p];
+            const HashedRow* probeRows = probe.data() + probeBounds[p];
+            size_t probeSize = probeBounds[p + 1] - probeBounds[p];
+            if (buildSize == 0 || probeSize == 0) return;
+
+            size_t capacity = 16;
+            while (capacity < buildSize * 2) capacity <<= 1;
+            size_t mask = capacity - 1;
+            std::vector<uint32_t> slots(capacity, UINT32_MAX);
+            std::vector<uint32_t> next(buildSize, UINT32_MAX);
+            for (size_t i = buildSize; i-- > 0;) {
+                size_t slot = buildRows[i].hash & mask;
+                while (slots[slot] != UINT32_MAX) {
+                    const HashedRow& head = buildRows[slots[slot]];
+                    if (head.hash == buildRows[i].hash && buildKey(head.row) == buildKey(buildRows[i].row)) break;
+                    slot = (slot + 1) & mask;
+                }
+                next[i] = slots[slot];
+                slots[slot] = static_cast<uint32_t>(i);
+            }
+
+            auto& out = found[p];
+            const size_t PREFETCH_DISTANCE = 8;
+            for (size_t i = 0; i < probeSize; ++i) {
+#if defined(__GNUC__)
+                if (i + PREFETCH_DISTANCE < probeSize) __builtin_prefetch(&slots[probeRows[i + PREFETCH_DISTANCE].hash & mask]);
+#endif
+                size_t slot = probeRows[i].hash & mask;
+                while (slots[slot] != UINT32_MAX) {
+                    const HashedRow& head = buildRows[slots[slot]];
+                    if (head.hash == probeRows[i].hash && buildKey(head.row) == probeKey(probeRows[i].row)) {
+                        for (uint32_t match = slots[slot]; match != UINT32_MAX; match = next[match]) {
+                            out.emplace_back(probeRows[i].row, buildRows[match].row);
+                        }
+                        break;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+            }
+        });
+        timings.buildProbe += millisSince(start);
+
+        // Back to probe order: a counting sort on the probe row. A probe
+        // row's matches all come from one partition, already in order.
+        start = Clock::now();
+        std::vector<size_t> firstMatch(probeCount + 1, 0);
+        for (const auto& part : found) {
+            for (const auto& match : part) firstMatch[match.first + 1]++;
+        }
+        for (size_t row = 0; row < probeCount; ++row) firstMatch[row + 1] += firstMatch[row];
+        size_t base = matches.size();
+        matches.resize(base + firstMatch[probeCount]);
+        for (const auto& part : found) {
+            for (const auto& match : part) matches[base + firstMatch[match.first]++] = match;
+        }
+        timings.order += millisSince(start);
+    }
+
+    // Join two row orders sorted by key; compare(left, right) is <0, 0 or >0.
+    // With leftOuter, left rows without a match pair with NO_ROW.
+    template <typename Compare>
+    static void mergeJoin(const std::vector<size_t>& leftOrder, const std::vector<size_t>& rightOrder, Compare compare,
+                          bool leftOuter, std::vector<std::pair<size_t, size_t>>& pairs) {
+        size_t i = 0, j = 0;
+        while (i < leftOrder.size()) {
+            int cmp = (j < rightOrder.size()) ? compare(leftOrder[i], rightOrder[j]) : -1;
+            if (cmp < 0) {
+                if (leftOuter) pairs.emplace_back(leftOrder[i], NO_ROW);
+                ++i;
+            } else if (cmp > 0) {
+                ++j;
+            } else {
+                // Every left row with this key pairs with the run of equal right keys
+                size_t runEnd = j + 1;
+                while (runEnd < rightOrder.size() && compare(leftOrder[i], rightOrder[runEnd]) == 0) ++runEnd;
+                do {
+                    for (size_t k = j; k < runEnd; ++k) pairs.emplace_back(leftOrder[i], rightOrder[k]);
+                    ++i;
+                } while (i < leftOrder.size() && compare(leftOrder[i], rightOrder[j]) == 0);
+                j = runEnd;
+            }
+        }
+    }
+
+    // Matching phase of join(): snapshots of both tables and the matched
+    // (our row, other row) pairs in output order, with NO_ROW for the other
+    // row of an unmatched LEFT_OUTER row. False if a table lacks the column.
+    bool joinPairs(const Table& otherTable, const std::string& columnName, JoinType type, JoinMethod method,
+                   JoinInput& left, JoinInput& right, std::vector<std::pair<size_t, size_t>>& pairs, JoinTimings& phases) const {
+        using Clock = std::chrono::steady_clock;
+        auto millisSince = [](Clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+
+        auto start = Clock::now();
+        left = joinInput(columnName);
+        right = otherTable.joinInput(columnName);
+        phases.snapshot = millisSince(start);
+        if(left.column == NO_ROW || right.column == NO_ROW){
+            std::cout << "Error: Column '" << columnName << "' not found in one or both tables." << std::endl;
+            return false;
+        }
+
+        const Table& leftRows = *left.rows;
+        const Table& rightRows = *right.rows;
+        const Column& leftKeys = leftRows.data[left.column];
+        const Column& rightKeys = rightRows.data[right.column];
+        bool leftOuter = (type == JoinType::LEFT_OUTER);
+
+        // Keys compare as stored int64 values when both columns hold the same
+        // typed values, as stored text when both hold text, and otherwise as
+        // cell text (which only a hash join handles)
+        bool typedKeys = !leftKeys.isText() && !rightKeys.isText() && leftKeys.getType() == rightKeys.getType();
+        bool textKeys = leftKeys.isText() && rightKeys.isText();
+
+        auto typedCompare = [&](size_t l, size_t r) {
+            int64_t a = leftKeys.value(l), b = rightKeys.value(r);
+            return a < b ? -1 : (a > b ? 1 : 0);
+        };
+        auto textCompare = [&](size_t l, size_t r) { return leftKeys.view(l).compare(rightKeys.view(r)); };
+
+        bool merge = false;
+        start = Clock::now();
+        if (typedKeys || textKeys) {
+            bool leftOrdered = left.keyOrder(typedKeys);
+            bool rightOrdered = right.keyOrder(typedKeys);
+            merge = (method == JoinMethod::SORT_MERGE) || (method == JoinMethod::AUTO && leftOrdered && rightOrdered);
+            if (merge) {
+                left.sortByKey();
+                right.sortByKey();
+                if (typedKeys) {
+                    mergeJoin(left.order, right.order, typedCompare, leftOuter, pairs);
+                } else {
+                    mergeJoin(left.order, right.order, textCompare, leftOuter, pairs);
+                }
+                phases.buildProbe = millisSince(start);
+            }
+        }
+
+        if (!merge) {
+            // Build the hash table on the smaller input and probe with the other
+            bool buildLeft = leftRows.rowCount < rightRows.rowCount;
+            const Column& buildKeys = buildLeft ? leftKeys : rightKeys;
+            const Column& probeKeys = buildLeft ? rightKeys : leftKeys;
+            size_t buildCount = buildLeft ? leftRows.rowCount : rightRows.rowCount;
+            size_t probeCount = buildLeft ? rightRows.rowCount : leftRows.rowCount;
+            bool parallel = (typedKeys || textKeys) && buildCount + probeCount >= PARALLEL_JOIN_ROWS;
+
+            // Dictionary-encoded keys on both sides hash as int64 codes. Each
+            // table has its own dictionary, so the other table's codes are
+            // translated into ours once per join (-1 for values we lack).
+            // The merge join above still compares text: codes are in
+            // insertion order, not key order.
+            bool codeKeys = leftKeys.isDictionary() && rightKeys.isDictionary();
+            std::vector<int64_t> leftCodes, rightCodes;
+            if (codeKeys) {
+                leftCodes.resize(leftKeys.getDictionary().size());
+                std::iota(leftCodes.begin(), leftCodes.end(), 0);
+                for (const auto& value : rightKeys.getDictionary()) {
+                    uint32_t code;
+                    rightCodes.push_back(leftKeys.findCode(value, code) ? static_cast<int64_t>(code) : -1);
+                }
+            }
+            const std::vector<int64_t>& buildCodes = buildLeft ? leftCodes : rightCodes;
+            const std::vector<int64_t>& probeCodes = buildLeft ? rightCodes : leftCodes;
+
+            if (parallel && typedKeys) {
+                radixHashJoin(buildCount, [&](size_t row) { return buildKeys.value(row); },
+                              probeCount, [&](size_t row) { return probeKeys.value(row); }, pairs, phases);
+            } else if (parallel && codeKeys) {
+                radixHashJoin(buildCount, [&](size_t row) { return buildCodes[buildKeys.code(row)]; },
+                              probeCount, [&](size_t row) { return probeCodes[probeKeys.code(row)]; }, pairs, phases);
+            } else if (parallel) {
+                radixHashJoin(buildCount, [&](size_t row) { return buildKeys.view(row); },
+                              probeCount, [&](size_t row) { return probeKeys.view(row); }, pairs, phases);
+            } else if (typedKeys) {
+                hashJoin<int64_t>(buildCount, [&](size_t row) { return buildKeys.value(row); },
+                                  probeCount, [&](size_t row) { return probeKeys.value(row); }, pairs);
+            } else if (codeKeys) {
+                hashJoin<int64_t>(buildCount, [&](size_t row) { return buildCodes[buildKeys.code(row)]; },
+                                  probeCount, [&](size_t row) { return probeCodes[probeKeys.code(row)]; }, pairs);
+            } else if (textKeys) {
+                hashJoin<std::string_view>(buildCount, [&](size_t row) { return buildKeys.view(row); },
+                                           probeCount, [&](size_t row) { return probeKeys.view(row); }, pairs);
+            } else {
+                hashJoin<std::string>(buildCount, [&](size_t row) { return buildKeys.get(row); },
+                                      probeCount, [&](size_t row) { return probeKeys.get(row); }, pairs);
+            }
+            if (!parallel) phases.buildProbe = millisSince(start);
+            start = Clock::now();
+
+            // pairs hold (probe, build) rows; turn them into (ours, other) in our row order
+            if (buildLeft) {
+                for (auto& pair : pairs) std::swap(pair.first, pair.second);
+                std::sort(pairs.begin(), pairs.end());
+            }
+            if (leftOuter) {
+                std::vector<std::pair<size_t, size_t>> all;
+                all.reserve(std::max(pairs.size(), leftRows.rowCount));
+                size_t next = 0;
+                for (size_t row = 0; row < leftRows.rowCount; ++row) {
+                    if (next < pairs.size() && pairs[next].first == row) {
+                        while (next < pairs.size() && pairs[next].first == row) all.push_back(pairs[next++]);
+                    } else {
+                        all.emplace_back(row, NO_ROW);
+                    }
+                }
+                pairs = std::move(all);
+            }
+            phases.order += millisSince(start);
+        }
+        return true;
+    }
+
+    // One joined row: our cells, then the other table's without the join
+    // column (empty when r is NO_ROW)
+    static void joinedRow(const Table& leftRows, const Table& rightRows, size_t rightColumn, size_t l, size_t r,
+                          std::vector<std::string>& joined) {
+        joined.reserve(leftRows.data.size() + rightRows.data.size() - 1);
+        for (const auto& column : leftRows.data) joined.push_back(column.get(l));
+        for (size_t i = 0; i < rightRows.data.size(); ++i) {
+            if (i == rightColumn) continue;
+            joined.push_back(r == NO_ROW ? std::string() : rightRows.data[i].get(r));
+        }
+    }
+
+    // Positions of the rows whose cell in columnIndex satisfies "cell op value".
+    // Numbers compare numerically; anything else only supports == and !=.
+    std::vector<size_t> matchRows(size_t columnIndex, const std::string& op, const std::string& value) const {
+        PredicatePlan plan;
+        plan.root = compileLeaf(plan, columnIndex, op, value);
+        return matchingRows(plan);
+    }
+
+    // Compare a cell with a condition value: numerically when both parse as
+    // numbers, otherwise as strings (only == and != apply to strings)
+    static bool compareText(const std::string& cell, const std::string& op, const std::string& value) {
+        double conditionValue;
+        bool numeric = parseLeadingNumber(value, conditionValue);
+        return compareCellText(cell, parseCompareOp(op), numeric, conditionValue, value);
+    }
+
+    size_t addPlanNode(PredicatePlan& plan, PredicatePlan::Node node) const {
+        plan.nodes.push_back(std::move(node));
+        return plan.nodes.size() - 1;
+    }
+
+    size_t addConstantNode(PredicatePlan& plan, bool result) const {
+        PredicatePlan::Node node;
+        node.kind = PredicatePlan::Kind::CONSTANT;
+        node.result = result;
+        return addPlanNode(plan, std::move(node));
+    }
+
+    // Compile "column op value" into a leaf chosen by how the column is stored
+    size_t compileLeaf(PredicatePlan& plan, size_t columnIndex, const std::string& op, const std::string& value) const {
+        using Kind = PredicatePlan::Kind;
+        PredicatePlan::Node node;
+        node.column = columnIndex;
+        node.op = parseCompareOp(op);
+        node.text = value;
+        node.numeric = parseLeadingNumber(value, node.number);
+        if (node.op == CompareOp::INVALID) return addConstantNode(plan, false);
+
+        const Column& column = data[columnIndex];
+        if (!column.isText()) {
+            if (column.getType() == DataType::DATE && parseCanonicalDate(value, node.bound)) {
+                node.kind = Kind::DATE;
+            } else if (node.numeric && column.getType() == DataType::DATE) {
+                // Numbers compare with the cell's numeric prefix, which for a date is its year
+                node.kind = Kind::DATE_YEAR;
+            } else if (node.numeric) {
+                bool outcome;
+                if (!integerBound(node.op, node.number, node.bound, outcome)) {
+                    return addConstantNode(plan, outcome);
+                }
+                node.kind = Kind::INTEGER;
+            } else {
+                // A formatted typed cell never equals non-numeric text
+                return addConstantNode(plan, node.op == CompareOp::NE);
+            }
+        } else {
+            node.dateBound = column.getType() == DataType::DATE && parseCanonicalDate(value, node.bound);
+            if (column.isDictionary()) {
+                // Decide the outcome once per distinct value
+                node.kind = Kind::DICTIONARY;
+                for (const auto& entry : column.getDictionary()) {
+                    node.codeMatches.push_back(compareTextLeaf(entry, node));
+                }
+            } else {
+                node.kind = Kind::TEXT;
+            }
+        }
+        return addPlanNode(plan, std::move(node));
+    }
+
+    // A text cell against a TEXT or DICTIONARY leaf. On a DATE column that
+    // fell back to text, cells that are dates compare with a date constant
+    // by day, as typed DATE storage does; other cells as compareCellText.
+    static bool compareTextLeaf(std::string_view cell, const PredicatePlan::Node& node) {
+        int64_t days;
+        if (node.dateBound && parseCanonicalDate(cell, days)) return applyCompare(node.op, days, node.bound);
+        return compareCellText(cell, node.op, node.numeric, node.number, node.text);
+    }
+
+    size_t compileLeaf(PredicatePlan& plan, const Condition& condition) const {
+        size_t columnIndex = findColumnIndex(condition.column);
+        if (columnIndex == static_cast<size_t>(-1)) {
+            std::cout << "Error: Column '" << condition.column << "' not found." << std::endl;
+            return addConstantNode(plan, false);
+        }
+        return compileLeaf(plan, columnIndex, condition.op, condition.value);
+    }
+
+    // Children are compiled first so a group only needs their node numbers
+    size_t compileGroup(PredicatePlan& plan, const std::string& logicalOp, std::vector<size_t> children) const {
+        if (logicalOp != "AND" && logicalOp != "OR") return addConstantNode(plan, false);
+        PredicatePlan::Node node;
+        node.kind = (logicalOp == "AND") ? PredicatePlan::Kind::AND : PredicatePlan::Kind::OR;
+        node.children = std::move(children);
+        return addPlanNode(plan, std::move(node));
+    }
+
+    size_t compileCondition(PredicatePlan& plan, const Condition& condition) const {
+        if (!condition.isGroup) return compileLeaf(plan, condition);
+        std::vector<size_t> children;
+        for (const auto& subcondition : condition.subconditions) {
+            children.push_back(compileCondition(plan, subcondition));
+        }
+        return compileGroup(plan, condition.logicalOp, std::move(children));
+    }
+
+    size_t compileConditionGroup(PredicatePlan& plan, const ConditionGroup& group) const {
+        std::vector<size_t> children;
+        for (const auto& condition : group.conditions) {
+            children.push_back(compileLeaf(plan, condition));
+        }
+        for (const auto& subgroup : group.subgroups) {
+            children.push_back(compileConditionGroup(plan, subgroup));
+        }
+        return compileGroup(plan, group.logicalOp, std::move(children));
+    }
+
+    PredicatePlan compilePredicate(const Condition& condition) const {
+        PredicatePlan plan;
+        plan.root = compileCondition(plan, condition);
+        return plan;
+    }
+
+    PredicatePlan compilePredicate(const ConditionGroup& group) const {
+        PredicatePlan plan;
+        plan.root = compileConditionGroup(plan, group);
+        return plan;
+    }
+
+    bool evaluatePlan(const PredicatePlan& plan, size_t nodeIndex, size_t row) const {
+        using Kind = PredicatePlan::Kind;
+        const PredicatePlan::Node& node = plan.nodes[nodeIndex];
+        switch (node.kind) {
+            case Kind::CONSTANT:
+                return node.result;
+            case Kind::AND:
+                for (size_t child : node.children) {
+                    if (!evaluatePlan(plan, child, row)) return false;  // Short-circuit for AND
+                }
+                return true;
+            case Kind::OR:
+                for (size_t child : node.children) {
+                    if (evaluatePlan(plan, child, row)) return true;    // Short-circuit for OR
+                }
+                return false;
+            case Kind::INTEGER:
+            case Kind::DATE:
+                return applyCompare(node.op, data[node.column].value(row), node.bound);
+            case Kind::DATE_YEAR: {
+                int64_t year;
+                unsigned month, day;
+                civilFromDays(data[node.column].value(row), year, month, day);
+                return applyCompare(node.op, static_cast<double>(year), node.number);
+            }
+            case Kind::DICTIONARY:
+                return node.codeMatches[data[node.column].code(row)];
+            case Kind::TEXT:
+                return compareTextLeaf(data[node.column].view(row), node);
+        }
+        return false;
+    }
+
+    // Rows among candidates that the plan node accepts. candidates covers
+    // the rows [begin, begin + candidates.size()), where begin is a multiple
+    // of BLOCK_ROWS, and so does the result. Typed leaves run the SIMD
+    // compare kernels over whole blocks; AND and OR combine bitmaps and
+    // only pass the rows that are still undecided on to later children, so
+    // per-row text leaves run on as few rows as possible.
+    SelectionBitmap evaluateBitmap(const PredicatePlan& plan, size_t nodeIndex, const SelectionBitmap& candidates,
+                                   size_t begin = 0) const {
+        using Kind = PredicatePlan::Kind;
+        const PredicatePlan::Node& node = plan.nodes[nodeIndex];
+        size_t rows = candidates.size();
+        size_t firstBlock = begin / BLOCK_ROWS;
+        size_t lastBlock = (begin + rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+
+        switch (node.kind) {
+            case Kind::CONSTANT:
+                return node.result ? candidates : SelectionBitmap(rows);
+            case Kind::AND: {
+                SelectionBitmap selected = candidates;
+                for (size_t child : orderedChildren(plan, node)) {
+                    if (selected.none()) break;
+                    selected = evaluateBitmap(plan, child, selected, begin);
+                }
+                return selected;
+            }
+            case Kind::OR: {
+                SelectionBitmap selected(rows);
+                SelectionBitmap remaining = candidates;
+                for (size_t child : orderedChildren(plan, node)) {
+                    if (remaining.none()) break;
+                    SelectionBitmap matched = evaluateBitmap(plan, child, remaining, begin);
+                    selected.orWith(matched);
+                    remaining.andNotWith(matched);
+                }
+                return selected;
+            }
+            case Kind::INTEGER:
+            case Kind::DATE: {
+                // Blocks whose zone map decides the leaf are skipped or
+                // selected whole; only the rest run the compare kernel
+                SelectionBitmap selected(rows);
+                const auto& blocks = data[node.column].getBlocks();
+                for (size_t b = firstBlock; b < lastBlock; ++b) {
+                    const Column::Block& block = *blocks[b];
+                    size_t base = b * BLOCK_ROWS - begin;
+                    switch (zoneOutcome(node.op, node.bound, block)) {
+                        case ZoneOutcome::NONE: break;
+                        case ZoneOutcome::ALL: selected.setRange(base, base + block.values.size()); break;
+                        case ZoneOutcome::SOME:
+                            compareInt64(block.values.data(), block.values.size(), node.op, node.bound, selected.wordsAt(base));
+                            break;
+                    }
+                }
+                selected.andWith(candidates);
+                return selected;
+            }
+            case Kind::DICTIONARY: {
+                SelectionBitmap selected(rows);
+                const auto& blocks = data[node.column].getBlocks();
+                for (size_t b = firstBlock; b < lastBlock; ++b) {
+                    const auto& codes = blocks[b]->codes;
+                    size_t base = b * BLOCK_ROWS - begin;
+                    for (size_t i = 0; i < codes.size(); ++i) {
+                        if (node.codeMatches[codes[i]]) selected.set(base + i);
+                    }
+                }
+                selected.andWith(candidates);
+                return selected;
+            }
+            default: {
+                SelectionBitmap selected(rows);
+                candidates.forEach([&](size_t row) {
+                    if (evaluatePlan(plan, nodeIndex, begin + row)) selected.set(row);
+                });
+                return selected;
+            }
+        }
+    }
+
+    enum class ZoneOutcome { NONE, SOME, ALL };
+
+    // How many values of a typed block can satisfy "value op bound", going
+    // by the block's zone map alone
+    static ZoneOutcome zoneOutcome(CompareOp op, int64_t bound, const Column::Block& block) {
+        if (block.values.empty()) return ZoneOutcome::NONE;
+        if (op == CompareOp::EQ || op == CompareOp::NE) {
+            bool all = (block.minValue == bound && block.maxValue == bound);
+            bool none = (bound < block.minValue || bound > block.maxValue);
+            if (op == CompareOp::NE) std::swap(all, none);
+            return all ? ZoneOutcome::ALL : (none ? ZoneOutcome::NONE : ZoneOutcome::SOME);
+        }
+        // <, <=, > and >= are monotonic, so checking both ends is enough
+        bool atMin = applyCompare(op, block.minValue, bound);
+        bool atMax = applyCompare(op, block.maxValue, bound);
+        if (atMin && atMax) return ZoneOutcome::ALL;
+        return (atMin || atMax) ? ZoneOutcome::SOME : ZoneOutcome::NONE;
+    }
+
+    // Smallest and largest numeric value (as numericCell reads it) of a
+    // typed INTEGER or DATE column, from the block zone maps. A date's
+    // numeric value is its year, which grows with the day number, so the
+    // years of the extreme days are the extreme years. False for text
+    // columns or an empty table.
+    bool typedRange(size_t columnIndex, double& minValue, double& maxValue) const {
+        const Column& column = data[columnIndex];
+        if (column.isText() || rowCount == 0) return false;
+        int64_t low = std::numeric_limits<int64_t>::max();
+        int64_t high = std::numeric_limits<int64_t>::min();
+        for (const auto& block : column.getBlocks()) {
+            low = std::min(low, block->minValue);
+            high = std::max(high, block->maxValue);
+        }
+        if (column.getType() == DataType::DATE) {
+            unsigned month, day;
+            civilFromDays(low, low, month, day);
+            civilFromDays(high, high, month, day);
+        }
+        minValue = static_cast<double>(low);
+        maxValue = static_cast<double>(high);
+        return true;
+    }
+
+    // Children of a group with the bitmap-friendly leaves first
+    std::vector<size_t> orderedChildren(const PredicatePlan& plan, const PredicatePlan::Node& node) const {
+        using Kind = PredicatePlan::Kind;
+        std::vector<size_t> children = node.children;
+        std::stable_partition(children.begin(), children.end(), [&](size_t child) {
+            Kind kind = plan.nodes[child].kind;
+            return kind == Kind::CONSTANT || kind == Kind::INTEGER || kind == Kind::DATE || kind == Kind::DICTIONARY;
+        });
+        return children;
+    }
+
+    // Rows [begin, end) that the plan accepts, as a bitmap over that range
+    SelectionBitmap morselBitmap(const PredicatePlan& plan, size_t begin, size_t end) const {
+        SelectionBitmap all(end - begin);
+        all.setAll();
+        return evaluateBitmap(plan, plan.root, all, begin);
+    }
+
+    // Run fn(begin, end) for every morsel of the table on the shared thread
+    // pool. Threads claim the next morsel as they finish one, so a morsel
+    // full of slow text matches does not hold the others up.
+    template <typename Fn>
+    void forEachMorsel(Fn&& fn) const {
+        size_t morsels = (rowCount + MORSEL_ROWS - 1) / MORSEL_ROWS;
+        ThreadPool::shared().parallelFor(morsels, [&](size_t morsel) {
+            fn(morsel * MORSEL_ROWS, std::min(rowCount, (morsel + 1) * MORSEL_ROWS));
+        }, scanOptions.maxThreads);
+    }
+
+    SelectionBitmap matchingBitmap(const PredicatePlan& plan) const {
+        SelectionBitmap selected(rowCount);
+        forEachMorsel([&](size_t begin, size_t end) { selected.assignAt(begin, morselBitmap(plan, begin, end)); });
+        return selected;
+    }
+
+    // Scan executor: rows chosen by matches(begin, end, positions), which
+    // appends the matching rows of a morsel in ascending order. Morsels are
+    // scanned and materialized in parallel. With scanOptions.ordered the
+    // rows come back in table order; otherwise each morsel's rows are
+    // added as soon as it is done.
+    template <typename Matches>
+    std::vector<std::vector<std::string>> scanMatches(Matches&& matches, const std::vector<size_t>& outputColumns = {}) const {
+        std::vector<std::vector<std::string>> result;
+        if (!scanOptions.ordered) {
+            std::mutex resultMutex;
+            forEachMorsel([&](size_t begin, size_t end) {
+                std::vector<size_t> positions;
+                matches(begin, end, positions);
+                std::vector<std::vector<std::string>> rows = materializeRows(positions, outputColumns);
+                std::lock_guard<std::mutex> lock(resultMutex);
+                result.insert(result.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+            });
+            return result;
+        }
+
+        // Find every morsel's rows, then materialize them into place
+        std::vector<std::vector<size_t>> found((rowCount + MORSEL_ROWS - 1) / MORSEL_ROWS);
+        forEachMorsel([&](size_t begin, size_t end) { matches(begin, end, found[begin / MORSEL_ROWS]); });
+        std::vector<size_t> offsets(found.size() + 1, 0);
+        for (size_t morsel = 0; morsel < found.size(); ++morsel) {
+            offsets[morsel + 1] = offsets[morsel] + found[morsel].size();
+        }
+        result.resize(offsets.back());
+        ThreadPool::shared().parallelFor(found.size(), [&](size_t morsel) {
+            for (size_t k = 0; k < found[morsel].size(); ++k) result[offsets[morsel] + k] = rowAt(found[morsel][k], outputColumns);
+        }, scanOptions.maxThreads);
+        return result;
+    }
+
+    std::vector<std::vector<std::string>> scanMatches(const PredicatePlan& plan, const std::vector<size_t>& outputColumns = {}) const {
+        return scanMatches([&](size_t begin, size_t end, std::vector<size_t>& positions) {
+            morselBitmap(plan, begin, end).forEach([&](size_t row) { positions.push_back(begin + row); });
+        }, outputColumns);
+    }
+
+    // Positions of all rows the plan accepts, from the indexes when they
+    // can answer it
+    std::vector<size_t> matchingRows(const PredicatePlan& plan) const {
+        std::vector<size_t> positions;
+        if (indexedMatches(plan, positions)) return positions;
+        return matchingBitmap(plan).positions();
+    }
+
+    // First index of the given type on a column that matches how the column
+    // is stored now (a B+tree keyed by int64 is unusable once the column
+    // has fallen back to text storage)
+    const Index* findUsableIndex(size_t columnIndex, IndexType type) const {
+        for (const auto& idx : indexes) {
+            if (idx.type != type || findColumnIndex(idx.column) != columnIndex) continue;
+            if (type == IndexType::BTREE && idx.typedKeys == data[columnIndex].isText()) continue;
+            return &idx;
+        }
+        return nullptr;
+    }
+
+    // Inclusive range of stored int64 values on one typed column
+    struct KeyRange {
+        size_t column = 0;
+        int64_t low = std::numeric_limits<int64_t>::min();
+        int64_t high = std::numeric_limits<int64_t>::max();
+    };
+
+    // The range of stored values a typed leaf accepts; false if the leaf is
+    // not a single range (text leaves, !=, ...)
+    bool leafRange(const PredicatePlan::Node& leaf, KeyRange& range) const {
+        using Kind = PredicatePlan::Kind;
+        if (leaf.kind != Kind::INTEGER && leaf.kind != Kind::DATE) return false;
+        range = KeyRange();
+        range.column = leaf.column;
+        const int64_t minValue = std::numeric_limits<int64_t>::min();
+        const int64_t maxValue = std::numeric_limits<int64_t>::max();
+        switch (leaf.op) {
+            case CompareOp::EQ: range.low = range.high = leaf.bound; break;
+            case CompareOp::LE: range.high = leaf.bound; break;
+            case CompareOp::GE: range.low = leaf.bound; break;
+            case CompareOp::LT:
+                if (leaf.bound == minValue) std::swap(range.low, range.high);  // empty
+                else range.high = leaf.bound - 1;
+                break;
+            case CompareOp::GT:
+                if (leaf.bound == maxValue) std::swap(range.low, range.high);  // empty
+                else range.low = leaf.bound + 1;
+                break;
+            default:
+                return false;
+        }
+        return true;
+    }
+
+    // Rows whose stored value lies in range, sorted; false without an index
+    bool lookupRange(const KeyRange& range, std::vector<size_t>& rows) const {
+        if (const Index* tree = findUsableIndex(range.column, IndexType::BTREE)) {
+            if (range.low <= range.high) {
+                tree->typedTree.range(&range.low, true, &range.high, true, [&](const auto& entry) { rows.push_back(entry.row); });
+            }
+        } else if (const Index* hash = findUsableIndex(range.column, IndexType::HASH); hash && range.low == range.high) {
+            auto it = hash->indexMap.find(data[range.column].decode(range.low));
+            if (it != hash->indexMap.end()) rows = it->second;
+        } else {
+            return false;
+        }
+        std::sort(rows.begin(), rows.end());
+        return true;
+    }
+
+    // Rows whose cell text is exactly key, sorted; false without an index
+    bool lookupText(size_t columnIndex, const std::string& key, std::vector<size_t>& rows) const {
+        if (const Index* tree = findUsableIndex(columnIndex, IndexType::BTREE)) {
+            tree->textTree.range(&key, true, &key, true, [&](const auto& entry) { rows.push_back(entry.row); });
+        } else if (const Index* hash = findUsableIndex(columnIndex, IndexType::HASH)) {
+            auto it = hash->indexMap.find(key);
+            if (it != hash->indexMap.end()) rows = it->second;
+        } else {
+            return false;
+        }
+        std::sort(rows.begin(), rows.end());
+        return true;
+    }
+
+    // Rows accepted by a single leaf, answered from an index
+    bool lookupLeaf(const PredicatePlan::Node& leaf, std::vector<size_t>& rows) const {
+        using Kind = PredicatePlan::Kind;
+        KeyRange range;
+        if (leafRange(leaf, range)) return lookupRange(range, rows);
+        // Text leaves only reduce to an exact key for non-numeric equality
+        bool textEquality = (leaf.kind == Kind::TEXT || leaf.kind == Kind::DICTIONARY) && !leaf.numeric && leaf.op == CompareOp::EQ;
+        return textEquality && lookupText(leaf.column, leaf.text, rows);
+    }
+
+    // Answer a plan from indexes. A leaf or an AND needs one indexed child
+    // (typed ranges on the same column are intersected first) and the
+    // candidates it yields are checked against the whole plan; an OR needs
+    // every child indexed. Returns false when indexes cannot help.
+    bool indexedMatches(const PredicatePlan& plan, std::vector<size_t>& positions) const {
+        using Kind = PredicatePlan::Kind;
+        const PredicatePlan::Node& root = plan.nodes[plan.root];
+        bool isOr = (root.kind == Kind::OR);
+        std::vector<size_t> leaves = (root.kind == Kind::AND || isOr) ? root.children : std::vector<size_t>{plan.root};
+
+        std::vector<std::vector<size_t>> candidateLists;
+        std::vector<KeyRange> ranges;
+        for (size_t leafIndex : leaves) {
+            const PredicatePlan::Node& leaf = plan.nodes[leafIndex];
+            KeyRange range;
+            if (!isOr && leafRange(leaf, range)) {
+                auto same = std::find_if(ranges.begin(), ranges.end(), [&](const KeyRange& r) { return r.column == range.column; });
+                if (same == ranges.end()) {
+                    ranges.push_back(range);
+                } else {
+                    same->low = std::max(same->low, range.low);
+                    same->high = std::min(same->high, range.high);
+                }
+                continue;
+            }
+            std::vector<size_t> rows;
+            if (lookupLeaf(leaf, rows)) candidateLists.push_back(std::move(rows));
+            else if (isOr) return false;
+        }
+        for (const auto& range : ranges) {
+            std::vector<size_t> rows;
+            if (lookupRange(range, rows)) candidateLists.push_back(std::move(rows));
+        }
+        if (candidateLists.empty()) return false;
+
+        // A scan beats gathering and sorting a large share of the table
+        size_t candidates = isOr ? 0 : rowCount;
+        for (const auto& rows : candidateLists) {
+            candidates = isOr ? candidates + rows.size() : std::min(candidates, rows.size());
+        }
+        if (candidates > rowCount / 4) return false;
 
-enum class DataType {
-    INTEGER,
-    STRING,
-    DATE
-};
+        if (isOr) {
+            for (const auto& rows : candidateLists) positions.insert(positions.end(), rows.begin(), rows.end());
+            std::sort(positions.begin(), positions.end());
+            positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+            return true;
+        }
 
-class Transaction {
-public:
-    std::vector<std::vector<std::string>> inserts;
-    std::vector<std::pair<size_t, std::vector<std::string>>> updates;  // (row index, new data)
-    std::vector<size_t> deletes;  // Row indices
+        auto smallest = std::min_element(candidateLists.begin(), candidateLists.end(),
+            [](const std::vector<size_t>& a, const std::vector<size_t>& b) { return a.size() < b.size(); });
+        for (size_t row : *smallest) {
+            if (evaluatePlan(plan, plan.root, row)) positions.push_back(row);
+        }
+        return true;
+    }
 
-    void clear() {
-        inserts.clear();
-        updates.clear();
-        deletes.clear();
+    // Append the rows accept(row) takes in index order, recording where
+    // each run of equal keys starts. The walk stops at the first run that
+    // starts once wanted rows are collected, so only the rows that can be
+    // returned and the ties of the last one are kept.
+    template <typename Key, typename Accept>
+    static void collectInIndexOrder(const BPlusTree<Key>& tree, bool ascending, Accept&& accept, size_t wanted,
+                                    std::vector<size_t>& positions, std::vector<size_t>& runStarts) {
+        const Key* previous = nullptr;
+        tree.forEachWhile(ascending, [&](const typename BPlusTree<Key>::Entry& entry) {
+            if (!accept(entry.row)) return true;
+            if (!previous || *previous != entry.key) {
+                if (positions.size() >= wanted) return false;
+                runStarts.push_back(positions.size());
+            }
+            previous = &entry.key;
+            positions.push_back(entry.row);
+            return true;
+        });
     }
-};
 
-class Table {
-private:
-    std::string tableName;
-    std::vector<std::vector<std::string>> rows;
-    std::vector<std::string> columns;
-    std::vector<DataType> columnTypes; // store data type of each column
+    std::vector<std::vector<std::string>> materializeRows(const std::vector<size_t>& positions,
+                                                          const std::vector<size_t>& outputColumns = {}) const {
+        std::vector<std::vector<std::string>> result;
+        result.reserve(positions.size());
+        for (size_t pos : positions) {
+            result.push_back(rowAt(pos, outputColumns));
+        }
+        return result;
+    }
 
-    std::unordered_map<std::string, size_t> index;
-    // Multi-column index for faster querying based on multiple columns
-    std::unordered_map<std::tuple<std::string, std::string>, size_t, TupleHasher> multiColumnIndex;
-    bool inTransaction = false;
-    std::vector<std::vector<std::string>> transactionBackup;
+    // Write the table file; the caller holds the write lock or calls it on
+    // a snapshot, so the rows cannot change underneath it
+    bool writeTableFile(const std::string& filename){
+        std::ofstream outFile(filename, std::ios::binary | std::ios::trunc);
 
-    // Lock for concurrency control
-    std::mutex tableMutex;
-    std::vector<Index> indexes;
-    std::vector<Transaction> transactions; 
+        if(outFile.is_open()){
+            PageWriter writer(outFile);
+
+            // header: format, schema and row count
+            writer.writeBytes(TABLE_FILE_MAGIC, sizeof(TABLE_FILE_MAGIC));
+            writer.write(TABLE_FILE_VERSION);
+            writer.write(static_cast<uint32_t>(PAGE_SIZE));
+            writer.write(TABLE_FILE_BYTE_ORDER);
+            writer.write(static_cast<uint32_t>(columns.size()));
+            writer.write(static_cast<uint64_t>(rowCount));
+            writer.write(logSequence);
+            writer.writeString(tableName);
+            for(size_t i = 0; i < columns.size(); i++){
+                ColumnStorage storage = data[i].isDictionary() ? ColumnStorage::DICTIONARY
+                                      : data[i].isText() ? ColumnStorage::TEXT : ColumnStorage::TYPED;
+                writer.writeString(columns[i]);
+                writer.write(static_cast<uint8_t>(columnTypes[i]));
+                writer.write(static_cast<uint8_t>(storage));
+            }
+            writer.padToPage();
+
+            // one chunk per dictionary and per block, each on its own pages
+            std::vector<TableFileChunk> chunks;
+            auto beginChunk = [&](size_t column, ChunkKind kind, size_t rows) {
+                chunks.push_back({static_cast<uint32_t>(column), static_cast<uint32_t>(kind), static_cast<uint32_t>(rows), 0, writer.tell(), 0});
+            };
+            auto endChunk = [&]() {
+                chunks.back().length = writer.tell() - chunks.back().offset;
+                writer.padToPage();
+            };
+            for(size_t i = 0; i < data.size(); i++){
+                const Column& column = data[i];
+                if(column.isDictionary()){
+                    beginChunk(i, ChunkKind::DICTIONARY, column.getDictionary().size());
+                    for(const auto& value : column.getDictionary()){
+                        writer.writeString(value);
+                    }
+                    endChunk();
+                }
+                for(const auto& block : column.getBlocks()){
+                    if(column.isDictionary()){
+                        beginChunk(i, ChunkKind::CODES, block->size());
+                        writer.writeArray(block->codes);
+                    } else if(column.isText()){
+                        beginChunk(i, ChunkKind::TEXT, block->size());
+                        writer.writeArray(block->offsets);
+                        writer.writeBytes(block->bytes.data(), block->bytes.size());
+                    } else {
+                        beginChunk(i, ChunkKind::VALUES, block->size());
+                        writer.writeArray(block->values);
+                    }
+                    endChunk();
+                }
+            }
+
+            // footer, with the trailer ending on a page boundary
+            TableFileTrailer trailer{writer.tell(), chunks.size(), {}};
+            std::memcpy(trailer.magic, TABLE_FILE_END, sizeof(trailer.magic));
+            writer.writeArray(chunks);
+            writer.padToPage(sizeof(trailer));
+            writer.write(trailer);
+
+            outFile.close();
+            if(outFile.fail()){
+                std::cout << "Error: Failed while writing " << filename << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        std::cout << "Error: Unable to open file for writing." << std::endl;
+        return false;
+    }
+
+    // Turn the changes recorded so far into one log record; returns the log
+    // position to wait for, or 0 if nothing was logged
+    uint64_t endLogRecord() {
+        if (!wal || redo.empty()) return 0;
+        uint64_t position = appendLogRecord(redo);
+        redo.clear();
+        return position;
+    }
+
+    // Number changes as the next log record and buffer it. Partition
+    // writers only share the table lock, so numbering and appending happen
+    // together under logMutex to keep sequence numbers in log order.
+    uint64_t appendLogRecord(const std::string& changes) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::string payload;
+        appendBytes(payload, ++logSequence);
+        payload += changes;
+        return wal->append(payload);
+    }
+
+    bool waitForLog(uint64_t position) {
+        if (position == 0) return true;
+        if (!wal->sync(position, durability)) {
+            std::cout << "Error: Write to the log of table " << tableName << " failed; changes are not durable." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Rows per range formatted by one export task
+    static constexpr size_t EXPORT_ROWS = 16384;
+
+    // Format rows [begin, end) as CSV records into out, replacing its
+    // contents. INTEGER cells go straight from the stored value to text.
+    void formatCsvRows(size_t begin, size_t end, char delimiter, std::string& out) const {
+        out.clear();
+        char number[24];
+        for (size_t row = begin; row < end; ++row) {
+            for (size_t i = 0; i < data.size(); ++i) {
+                if (i > 0) out.push_back(delimiter);
+                const Column& column = data[i];
+                if (column.isText()) {
+                    appendCsvField(out, column.view(row), delimiter);
+                } else if (column.getType() == DataType::INTEGER) {
+                    out.append(number, std::to_chars(number, number + sizeof(number), column.value(row)).ptr);
+                } else {
+                    out += column.get(row);  // a formatted date needs no quotes
+                }
+            }
+            out.push_back('\n');
+        }
+    }
+
+    // Rows parsed from one chunk of a CSV file, in typed columns
+    struct CsvChunk {
+        std::vector<Column> columns;
+        uint64_t rows = 0;
+        uint64_t skipped = 0;   // records with the wrong number of fields
+        uint64_t invalid = 0;   // cells that are not a valid value of their column's type
+    };
+
+    // Aim for this many bytes per CSV chunk
+    static constexpr size_t CSV_CHUNK_BYTES = size_t(4) << 20;
+
+    // Bytes taken by the first record in [begin, end), line break included
+    static size_t countCsvRecordBytes(const char* begin, const char* end) {
+        bool quoted = false;
+        for (const char* p = begin; p < end; ++p) {
+            if (*p == '"') quoted = !quoted;
+            else if (*p == '\n' && !quoted) return p + 1 - begin;
+        }
+        return end - begin;
+    }
+
+    // Split [begin, end) into chunks that start on a record. A line break
+    // ends a record only outside quotes, which it is when the quotes before
+    // it are even in number; each chunk's quotes are counted in parallel
+    // to know that at every chunk's nominal start.
+    std::vector<const char*> csvChunkBounds(const char* begin, const char* end) const {
+        size_t size = end - begin;
+        size_t chunks = std::max<size_t>(1, size / CSV_CHUNK_BYTES);
+        std::vector<size_t> quotes(chunks, 0);
+        auto nominal = [&](size_t c) { return begin + size / chunks * c; };
+        ThreadPool::shared().parallelFor(chunks, [&](size_t c) {
+            quotes[c] = countCsvQuotes(nominal(c), c + 1 == chunks ? end : nominal(c + 1));
+        }, scanOptions.maxThreads);
+
+        std::vector<const char*> bounds = {begin};
+        size_t quotesBefore = 0;
+        for (size_t c = 1; c < chunks; ++c) {
+            quotesBefore += quotes[c - 1];
+            bool quoted = (quotesBefore % 2) != 0;
+            const char* p = std::max(nominal(c), bounds.back());
+            if (p != nominal(c)) quoted = false;  // the previous bound already starts a record
+            for (; p < end; ++p) {
+                if (*p == '"') quoted = !quoted;
+                else if (*p == '\n' && !quoted) break;
+            }
+            bounds.push_back(p < end ? p + 1 : end);
+        }
+        bounds.push_back(end);
+        return bounds;
+    }
+
+    void parseCsvChunk(const char* begin, const char* end, CsvChunk& chunk) const {
+        for (DataType type : columnTypes) chunk.columns.emplace_back(type);
+        CsvReader reader(begin, end);
+        std::vector<std::string_view> fields;
+        while (!reader.atEnd()) {
+            reader.next(fields);
+            if (fields.size() == 1 && fields[0].empty() && columns.size() != 1) continue;  // blank line
+            if (fields.size() != columns.size()) {
+                chunk.skipped++;
+                continue;
+            }
+            for (size_t i = 0; i < fields.size(); ++i) {
+                if (!chunk.columns[i].append(fields[i])) chunk.invalid++;
+            }
+            chunk.rows++;
+        }
+    }
+
+    // Index and log rows [firstRow, rowCount), appended straight to the columns.
+    // Each index takes the whole batch at once (see insertBatch and
+    // appendToBuckets) instead of a row at a time.
+    void indexAppendedRows(size_t firstRow) {
+        for (auto& idx : indexes) {
+            size_t columnIndex = findColumnIndex(idx.column);
+            if (columnIndex == static_cast<size_t>(-1)) continue;
+            const Column& column = data[columnIndex];
+            if (idx.type == IndexType::HASH) {
+                std::vector<std::pair<std::string, size_t>> pairs;
+                pairs.reserve(rowCount - firstRow);
+                for (size_t row = firstRow; row < rowCount; ++row) pairs.emplace_back(column.get(row), row);
+                appendToBuckets(idx.indexMap, std::move(pairs));
+            } else if (idx.typedKeys && column.isText()) {
+                buildIndex(idx, columnIndex);  // the column fell back to text storage; re-key the tree once
+            } else if (idx.typedKeys) {
+                std::vector<BPlusTree<int64_t>::Entry> entries;
+                entries.reserve(rowCount - firstRow);
+                for (size_t row = firstRow; row < rowCount; ++row) entries.push_back({column.value(row), row});
+                idx.typedTree.insertBatch(std::move(entries));
+            } else {
+                std::vector<BPlusTree<std::string>::Entry> entries;
+                entries.reserve(rowCount - firstRow);
+                for (size_t row = firstRow; row < rowCount; ++row) entries.push_back({std::string(column.view(row)), row});
+                idx.textTree.insertBatch(std::move(entries));
+            }
+        }
+        size_t idIndex = findColumnIndex("ID");
+        if (idIndex != static_cast<size_t>(-1)) {
+            std::vector<std::pair<std::tuple<std::string, std::string>, size_t>> pairs;
+            pairs.reserve(rowCount - firstRow);
+            for (size_t row = firstRow; row < rowCount; ++row) {
+                pairs.emplace_back(std::make_tuple(data[idIndex].get(row), std::string()), row);
+            }
+            appendToBuckets(multiColumnIndex, std::move(pairs));
+        }
+
+        if (logging()) {
+            for (size_t row = firstRow; row < rowCount; ++row) {
+                redo.push_back(static_cast<char>(RedoOp::APPEND));
+                appendBytes(redo, static_cast<uint32_t>(data.size()));
+                for (const auto& column : data) appendString(redo, column.get(row));
+            }
+        }
+    }
+
+    // Log the changes of the mutator that is finishing: close its record
+    // under the write lock, then release the lock before waiting for the
+    // record, so concurrent writers' waits overlap and share one flush
+    void logChanges(std::unique_lock<std::shared_mutex>& lock) {
+        uint64_t position = endLogRecord();
+        lock.unlock();
+        waitForLog(position);
+    }
+
+    // Apply one log record unless the rows already include it
+    bool replayRecord(const std::string& payload, std::string& error) {
+        ByteReader reader(payload.data(), payload.size());
+        uint64_t sequence = 0;
+        if (!reader.read(sequence)) {
+            error = "empty record";
+            return false;
+        }
+        if (sequence <= logSequence) return true;
+
+        while (reader.good() && !reader.atEnd()) {
+            uint8_t op = 0;
+            reader.read(op);
+            switch (static_cast<RedoOp>(op)) {
+                case RedoOp::RESET: {
+                    uint32_t count = 0;
+                    reader.read(count);
+                    std::vector<std::string> names;
+                    std::vector<DataType> types;
+                    bool validTypes = true;
+                    for (uint32_t i = 0; i < count && reader.good(); ++i) {
+                        std::string name;
+                        uint8_t type = 0;
+                        reader.readString(name);
+                        reader.read(type);
+                        validTypes = validTypes && type <= static_cast<uint8_t>(DataType::DATE);
+                        names.push_back(std::move(name));
+                        types.push_back(static_cast<DataType>(type));
+                    }
+                    if (!reader.good() || !validTypes) break;
+                    columns = std::move(names);
+                    columnTypes = std::move(types);
+                    resetStorage();
+                    continue;
+                }
+                case RedoOp::APPEND: {
+                    uint32_t count = 0;
+                    reader.read(count);
+                    if (count != columns.size()) break;
+                    std::vector<std::string> cells(count);
+                    for (auto& cell : cells) reader.readString(cell);
+                    if (!reader.good()) break;
+                    appendRowData(cells);
+                    continue;
+                }
+                case RedoOp::SET: {
+                    uint64_t row = 0;
+                    uint32_t column = 0;
+                    std::string value;
+                    reader.read(row);
+                    reader.read(column);
+                    reader.readString(value);
+                    if (!reader.good() || row >= rowCount || column >= columns.size()) break;
+                    setCell(row, column, value);
+                    continue;
+                }
+                case RedoOp::ERASE:
+                case RedoOp::PERMUTE: {
+                    uint64_t count = 0;
+                    reader.read(count);
+                    if (count > rowCount) break;
+                    std::vector<size_t> rows(count);
+                    for (auto& row : rows) {
+                        uint64_t value = 0;
+                        reader.read(value);
+                        row = static_cast<size_t>(value);
+                    }
+                    if (!reader.good()) break;
+                    if (static_cast<RedoOp>(op) == RedoOp::ERASE) {
+                        bool ascending = true;
+                        for (size_t i = 0; i < rows.size(); ++i) {
+                            if (rows[i] >= rowCount || (i > 0 && rows[i] <= rows[i - 1])) ascending = false;
+                        }
+                        if (!ascending) break;
+                        eraseRowData(rows);
+                    } else {
+                        std::vector<bool> seen(rowCount, false);
+                        bool permutation = (count == rowCount);
+                        for (size_t row : rows) {
+                            if (!permutation || row >= rowCount || seen[row]) { permutation = false; break; }
+                            seen[row] = true;
+                        }
+                        if (!permutation) break;
+                        permuteRowData(rows);
+                    }
+                    continue;
+                }
+            }
+            error = "record " + std::to_string(sequence) + " is invalid";
+            return false;
+        }
+        if (!reader.good()) {
+            error = "record " + std::to_string(sequence) + " is invalid";
+            return false;
+        }
+        logSequence = sequence;
+        return true;
+    }
+
+    // Rebuild every index after the rows were replaced wholesale
+    void rebuildIndexes() {
+        for (auto& idx : indexes) {
+            size_t columnIndex = findColumnIndex(idx.column);
+            if (columnIndex != static_cast<size_t>(-1)) {
+                buildIndex(idx, columnIndex);
+            } else {
+                idx.indexMap.clear();
+                idx.typedTree.clear();
+                idx.textTree.clear();
+            }
+        }
+        multiColumnIndex.clear();
+        size_t idIndex = findColumnIndex("ID");
+        if (idIndex != static_cast<size_t>(-1)) {
+            for (size_t row = 0; row < rowCount; ++row) {
+                multiColumnIndex[std::make_tuple(data[idIndex].get(row), std::string())].push_back(row);
+            }
+        }
+    }
+
+    // Parse a binary table file into new columns and, only if all of it is
+    // valid, replace the table's schema and rows with them
+    bool loadPages(const MappedFile& file, std::string& error) {
+        ByteReader header(file.data(), file.size());
+        char magic[8];
+        uint32_t version = 0, pageSize = 0, byteOrder = 0, columnCount = 0;
+        uint64_t rows = 0;
+        std::string name;
+        header.readBytes(magic, sizeof(magic));
+        header.read(version);
+        header.read(pageSize);
+        header.read(byteOrder);
+        if (!header.good() || byteOrder != TABLE_FILE_BYTE_ORDER) {
+            error = "written with a different byte order";
+            return false;
+        }
+        if (version < 1 || version > TABLE_FILE_VERSION || pageSize != PAGE_SIZE) {
+            error = "unsupported format version " + std::to_string(version);
+            return false;
+        }
+        uint64_t sequence = 0;
+        header.read(columnCount);
+        header.read(rows);
+        if (version >= 2) header.read(sequence);
+        header.readString(name);
+
+        std::vector<std::string> names(columnCount);
+        std::vector<DataType> types(columnCount);
+        std::vector<Column> loaded;
+        for (uint32_t i = 0; i < columnCount && header.good(); ++i) {
+            uint8_t type = 0, storage = 0;
+            header.readString(names[i]);
+            header.read(type);
+            header.read(storage);
+            if (type > static_cast<uint8_t>(DataType::DATE) || storage > static_cast<uint8_t>(ColumnStorage::DICTIONARY)) {
+                error = "bad schema for column " + names[i];
+                return false;
+            }
+            types[i] = static_cast<DataType>(type);
+            loaded.emplace_back(types[i]);
+            loaded.back().resetLayout(storage != static_cast<uint8_t>(ColumnStorage::TYPED), storage == static_cast<uint8_t>(ColumnStorage::DICTIONARY));
+        }
+        if (!header.good()) {
+            error = "truncated header";
+            return false;
+        }
+
+        TableFileTrailer trailer;
+        if (file.size() < sizeof(trailer)) {
+            error = "missing footer";
+            return false;
+        }
+        std::memcpy(&trailer, file.data() + file.size() - sizeof(trailer), sizeof(trailer));
+        size_t footerSpace = file.size() - sizeof(trailer);
+        if (std::memcmp(trailer.magic, TABLE_FILE_END, sizeof(trailer.magic)) != 0 || trailer.footerOffset > footerSpace ||
+            trailer.chunkCount > (footerSpace - trailer.footerOffset) / sizeof(TableFileChunk)) {
+            error = "missing footer";
+            return false;
+        }
+
+        for (uint64_t c = 0; c < trailer.chunkCount; ++c) {
+            TableFileChunk chunk;
+            std::memcpy(&chunk, file.data() + trailer.footerOffset + c * sizeof(chunk), sizeof(chunk));
+            bool dictionaryChunk = static_cast<ChunkKind>(chunk.kind) == ChunkKind::DICTIONARY;
+            if (chunk.column >= columnCount || chunk.offset % PAGE_SIZE != 0 ||
+                chunk.rows > (dictionaryChunk ? chunk.length / sizeof(uint32_t) : BLOCK_ROWS) ||
+                chunk.offset > trailer.footerOffset || chunk.length > trailer.footerOffset - chunk.offset) {
+                error = "chunk " + std::to_string(c) + " out of bounds";
+                return false;
+            }
+
+            Column& column = loaded[chunk.column];
+            ByteReader payload(file.data() + chunk.offset, chunk.length);
+            bool valid = false;
+            ChunkKind kind = static_cast<ChunkKind>(chunk.kind);
+            if (kind == ChunkKind::DICTIONARY) {
+                std::vector<std::string> values(chunk.rows);
+                for (auto& value : values) payload.readString(value);
+                valid = payload.good() && column.loadDictionary(std::move(values));
+            } else {
+                Column::Block block;
+                if (kind == ChunkKind::VALUES) {
+                    block.values.resize(chunk.rows);
+                    payload.readBytes(block.values.data(), chunk.rows * sizeof(int64_t));
+                } else if (kind == ChunkKind::CODES) {
+                    block.codes.resize(chunk.rows);
+                    payload.readBytes(block.codes.data(), chunk.rows * sizeof(uint32_t));
+                } else if (kind == ChunkKind::TEXT) {
+                    block.offsets.resize(static_cast<size_t>(chunk.rows) + 1);
+                    payload.readBytes(block.offsets.data(), block.offsets.size() * sizeof(uint32_t));
+                    size_t textBytes = chunk.length - std::min<uint64_t>(chunk.length, block.offsets.size() * sizeof(uint32_t));
+                    block.bytes.resize(textBytes);
+                    payload.readBytes(&block.bytes[0], textBytes);
+                }
+                valid = payload.good() && column.loadBlock(std::move(block));
+            }
+            if (!valid) {
+                error = "chunk " + std::to_string(c) + " is corrupt";
+                return false;
+            }
+        }
+
+        for (const auto& column : loaded) {
+            if (column.size() != rows) {
+                error = "columns have different row counts";
+                return false;
+            }
+        }
+
+        tableName = name;
+        columns = std::move(names);
+        columnTypes = std::move(types);
+        data = std::move(loaded);
+        rowCount = rows;
+        rebuildIndexes();
+
+        if (!logging()) {
+            logSequence = sequence;
+        } else {
+            // The log cannot point at the file, so it records the loaded
+            // rows themselves: a reset followed by every row
+            std::vector<std::vector<std::string>> loadedRows;
+            loadedRows.reserve(rowCount);
+            for (size_t row = 0; row < rowCount; ++row) loadedRows.push_back(rowAt(row));
+            resetStorage();
+            for (const auto& row : loadedRows) appendRowData(row);
+        }
+        return true;
+    }
+
+    // Older tab-separated text files: the table name, the column names, then
+    // one line per row with cells separated by whitespace
+    void loadTextFile(const std::string& fileName){
+        std::ifstream inFile(fileName);
+
+        if(inFile.is_open()){
+            std::string line;
+
+            // clear existing row (incase we are loading into existing table)
+            resetStorage();
+
+            // read table name
+            std::getline(inFile, tableName);
+
+            // read and skip the columns
+            std::getline(inFile, line);
+
+            // read each row of data
+            while(std::getline(inFile, line)){
+                std::stringstream ss(line);
+                std::vector<std::string> rowData;
+                std::string data;
+                while(ss >> data){
+                    rowData.push_back(data);
+                }
+                if(rowData.size() == columns.size()){
+                    appendRowData(rowData);
+                } else {
+                    std::cout << "Warning: Row has incorrect number of columns and will be skipped." << std::endl;
+                }
+            }
+
+            inFile.close();
+
+            std::cout << "Data loaded from " << fileName << std::endl;
+        } else {
+            std::cout << "Error: Unable to open file for reading." << std::endl;
+        }
+    }
 
 public:
+    // No LIMIT on a query
+    static constexpr size_t NO_LIMIT = static_cast<size_t>(-1);
+
+    // Pull-based result of a query (see openCursor). It reads a snapshot
+    // taken when it was opened and scans one morsel at a time as batches
+    // are asked for, so the first rows come back before the scan is done
+    // and only one morsel's matches are held at once. Row IDs are row
+    // positions in that snapshot.
+    class Cursor {
+    public:
+        static constexpr size_t BATCH_ROWS = 1024;
+
+        // Next batch of at most maxRows matching row IDs, in table order;
+        // false once there are none left. A batch is cut short rather than
+        // scan a further morsel once it holds some rows.
+        bool next(std::vector<size_t>& rowIds, size_t maxRows = BATCH_ROWS) {
+            rowIds.clear();
+            while (rowIds.size() < maxRows) {
+                if (pendingAt == pending.size()) {
+                    if (!rowIds.empty() || !scanMorsel()) break;
+                    continue;
+                }
+                size_t take = std::min(maxRows - rowIds.size(), pending.size() - pendingAt);
+                rowIds.insert(rowIds.end(), pending.begin() + pendingAt, pending.begin() + pendingAt + take);
+                pendingAt += take;
+            }
+            return !rowIds.empty();
+        }
+
+        // Next batch of matching rows as text cells
+        bool next(std::vector<std::vector<std::string>>& batch, size_t maxRows = BATCH_ROWS) {
+            batch.clear();
+            if (!next(ids, maxRows)) return false;
+            batch.reserve(ids.size());
+            for (size_t row : ids) batch.push_back(rows->rowAt(row, outputColumns));
+            return true;
+        }
+
+        // Text of one cell of a row returned by next; column counts in the
+        // table's columns, not the projection's
+        std::string cell(size_t rowId, size_t column) const { return rows->data[column].get(rowId); }
+
+        // Names of the columns in the rows next returns
+        std::vector<std::string> columnNames() const {
+            if (outputColumns.empty()) return rows->columns;
+            std::vector<std::string> names;
+            for (size_t column : outputColumns) names.push_back(rows->columns[column]);
+            return names;
+        }
+
+    private:
+        friend class Table;
+        Cursor() = default;
+
+        // Find the matches of the next morsel; false once all are scanned
+        bool scanMorsel() {
+            if (scanFrom >= rows->rowCount) return false;
+            size_t begin = scanFrom;
+            scanFrom = std::min(rows->rowCount, begin + MORSEL_ROWS);
+            pending.clear();
+            pendingAt = 0;
+            rows->morselBitmap(plan, begin, scanFrom).forEach([&](size_t row) { pending.push_back(begin + row); });
+            return true;
+        }
+
+        std::unique_ptr<Table> rows;
+        PredicatePlan plan;
+        std::vector<size_t> outputColumns;  // projection; empty for every column
+        size_t scanFrom = 0;             // first row not yet scanned
+        std::vector<size_t> pending;     // matches not yet returned
+        size_t pendingAt = 0;
+        std::vector<size_t> ids;
+    };
+
+    // Pull-based result of a join (see openJoinCursor). The matching row
+    // pairs are found when it is opened; rows are only built batch by batch.
+    class JoinCursor {
+    public:
+        static constexpr size_t BATCH_ROWS = 1024;
+
+        // Next batch of at most maxRows joined rows, laid out as join()
+        // returns them; false once there are none left
+        bool next(std::vector<std::vector<std::string>>& batch, size_t maxRows = BATCH_ROWS) {
+            batch.clear();
+            size_t end = std::min(pairs.size(), nextPair + maxRows);
+            batch.resize(end - nextPair);
+            for (size_t k = nextPair; k < end; ++k) {
+                joinedRow(*left.rows, *right.rows, right.column, pairs[k].first, pairs[k].second, batch[k - nextPair]);
+            }
+            nextPair = end;
+            return !batch.empty();
+        }
+
+        size_t size() const { return pairs.size(); }
+
+    private:
+        friend class Table;
+        JoinCursor() = default;
+
+        JoinInput left, right;
+        std::vector<std::pair<size_t, size_t>> pairs;
+        size_t nextPair = 0;
+    };
 
     // Default Constructor
     // Table() = default;
 
     Table(const std::string& name, const std::vector<std::string>& colNames, const std::vector<DataType>& colTypes): tableName(name), columns(colNames), columnTypes(colTypes) {
+        resetStorage();
         std::cout << "Table '" << tableName << "' created with columns: ";
         for (const auto& col : columns) {
             std::cout << col << " ";
@@ -102,6 +4602,31 @@ public:
         std::cout << std::endl;
     }
 
+    // Consistent read-only view of the table as it is now. Writers carry on
+    // while it is read; it has the rows but no indexes or log.
+    std::unique_ptr<Table> snapshot() const {
+        ReadLock lock = readLock();
+        return snapshotLocked();
+    }
+
+    LockStats lockStats() const {
+        LockStats stats;
+        stats.sharedAcquired = lockCounters.sharedAcquired.load(std::memory_order_relaxed);
+        stats.exclusiveAcquired = lockCounters.exclusiveAcquired.load(std::memory_order_relaxed);
+        stats.partitionAcquired = lockCounters.partitionAcquired.load(std::memory_order_relaxed);
+        stats.contended = lockCounters.contended.load(std::memory_order_relaxed);
+        stats.waitNanoseconds = lockCounters.waitNanoseconds.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void resetLockStats() {
+        lockCounters.sharedAcquired = 0;
+        lockCounters.exclusiveAcquired = 0;
+        lockCounters.partitionAcquired = 0;
+        lockCounters.contended = 0;
+        lockCounters.waitNanoseconds = 0;
+    }
+
 
     // Table joinTables(const Table& other, const std::string& joinColumn) const {
     //     // Find the column index in both tables
@@ -138,7 +4663,7 @@ public:
 
     // Add a row of data
     void addRow(std::vector<std::string> rowData) {
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
+        auto lock = writeLock();  // Lock for concurrency
 
         if (rowData.size() != columns.size()) {
             std::cout << "Error: Row size (" << rowData.size() << ") does not match the number of columns (" << columns.size() << ")." << std::endl;
@@ -152,7 +4677,7 @@ public:
             }
         }
 
-        rows.push_back(rowData);  // Add row to the table
+        appendRowData(rowData);  // Add row to the table
 
         // Try to find the index of the "ID" column for indexing (if present)
         size_t idIndex = -1;
@@ -163,19 +4688,54 @@ public:
             }
         }
 
-        // If the table has an "ID" column, update the index
+        // If the table has an "ID" column, appendRowData has indexed the row
+        // under (ID, "") in multiColumnIndex
         if (idIndex != -1) {
-            // For tables like "Grades" that don't have an "Age" column, we just index by "ID"
-            multiColumnIndex[std::make_tuple(rowData[idIndex], "")] = rows.size() - 1;  // Added empty string for the second element
-
             std::cout << "Row added and indexed by 'ID'." << std::endl;
         } else {
             std::cout << "Row added without 'ID' indexing." << std::endl;
         }
+        logChanges(lock);
     }
 
+    // Append a batch of rows under one lock. Rows are appended column by
+    // column, and the indexes and log are updated once for the batch;
+    // nothing is printed per row. As with importFromCSV, rows of the wrong
+    // size are left out and a cell that does not match its column's type
+    // is kept, the column storing it as text. Returns the number of rows
+    // added.
+    size_t addRows(std::vector<std::vector<std::string>> rows) {
+        auto lock = writeLock();
+
+        std::vector<char> valid(rows.size());
+        for (size_t r = 0; r < rows.size(); ++r) valid[r] = (rows[r].size() == columns.size());
+
+        size_t firstRow = rowCount;
+        size_t added = std::count(valid.begin(), valid.end(), 1);
+        size_t invalid = 0;
+        for (size_t i = 0; i < data.size(); ++i) {
+            for (size_t r = 0; r < rows.size(); ++r) {
+                if (valid[r] && !data[i].append(rows[r][i])) ++invalid;
+            }
+        }
+        rowCount += added;
+        rows = {};
+        indexAppendedRows(firstRow);
+
+        if (added < valid.size()) {
+            std::cout << "Warning: " << valid.size() - added << " rows had an incorrect number of columns and were skipped." << std::endl;
+        }
+        if (invalid > 0) {
+            std::cout << "Warning: " << invalid << " cells did not match their column type and are stored as text." << std::endl;
+        }
+        std::cout << added << " rows added to " << tableName << "." << std::endl;
+        logChanges(lock);
+        return added;
+    }
 
     void displayTable() {
+        if (!isSnapshot) return snapshot()->displayTable();
+
         std::cout << "Table: " << tableName << std::endl;
         for(const auto& col : columns){
             std::cout<< col << "\t";
@@ -183,14 +4743,34 @@ public:
 
         std::cout << std::endl;
         
-        for(const auto& row : rows){
-            for(const auto& data : row){
-                std::cout << data << "\t";
+        for(size_t row = 0; row < rowCount; ++row){
+            for(const auto& column : data){
+                std::cout << column.get(row) << "\t";
             }
             std::cout << std::endl;
         }
     }
 
+    // Store a text column as small integer codes into a dictionary of its
+    // distinct values. Worthwhile for low-cardinality columns; typed
+    // INTEGER/DATE columns are already compact and are left as they are.
+    void enableDictionaryEncoding(const std::string& columnName) {
+        auto lock = writeLock();
+
+        size_t columnIndex = findColumnIndex(columnName);
+        if (columnIndex == static_cast<size_t>(-1)) {
+            std::cout << "Error: Column '" << columnName << "' not found." << std::endl;
+            return;
+        }
+        if (!data[columnIndex].isText()) {
+            std::cout << "Column '" << columnName << "' is stored as typed values and is not dictionary encoded." << std::endl;
+            return;
+        }
+
+        data[columnIndex].enableDictionary();
+        std::cout << "Column '" << columnName << "' dictionary encoded with " << data[columnIndex].getDictionary().size() << " distinct values." << std::endl;
+    }
+
     int colunmFind(const std::string& columnName){
         size_t columnIndex = -1;
         for(size_t i=0; i < columns.size(); i++){
@@ -208,14 +4788,24 @@ public:
         return static_cast<int>(columnIndex); ;
     }
 
-    std::vector<std::vector<std::string>> selectRows(const std::string& columnName, const std::string& value) {
+    // Rows whose cell in columnName equals value. A projection list
+    // restricts (and orders) the columns returned; empty means all of them.
+    std::vector<std::vector<std::string>> selectRows(const std::string& columnName, const std::string& value,
+                                                     const std::vector<std::string>& projection = {}) {
         std::vector<std::vector<std::string>> result;
 
-        if(columnName == "ID"){
-            auto it = index.find(value);
-            if(it != index.end()){
-                result.push_back(rows[it->second]);
+        if(columnName == "ID" && !isSnapshot){
+            ReadLock lock = readLock();
+            std::vector<size_t> outputColumns;
+            if (!projectColumns(projection, outputColumns)) return result;
+            auto it = multiColumnIndex.find(std::make_tuple(value, std::string()));
+            if(it != multiColumnIndex.end()){
+                for (size_t row : it->second) {
+                    result.push_back(rowAt(row, outputColumns));
+                }
             }
+        }else if (!isSnapshot) {
+            return snapshot()->selectRows(columnName, value, projection);
         }else {
             // Find the index of the column with the given name
             size_t columnIndex = -1;
@@ -232,19 +4822,22 @@ public:
                 return result;
             }
 
-            // Iterate over the rows and check if the value in the specified column matches
-            for (const auto& row : rows) {
-                if (row[columnIndex] == value) {
-                    result.push_back(row);
+            std::vector<size_t> outputColumns;
+            if (!projectColumns(projection, outputColumns)) return result;
+
+            // Scan the rows for ones whose cell in the specified column matches
+            result = scanMatches([&](size_t begin, size_t end, std::vector<size_t>& positions) {
+                for (size_t row = begin; row < end; ++row) {
+                    if (data[columnIndex].equals(row, value)) positions.push_back(row);
                 }
-            }
+            }, outputColumns);
         }
 
         return result;
     }
 
     void updateRows(const std::string& columnName, const std::string& matchValue, const std::string& updateColumn, const std::string& newValue){
-        std::lock_guard<std::mutex> lock(tableMutex); 
+        auto lock = writeLock(); 
         size_t matchColumnIndex = -1;
         size_t updateColumnIndex = -1;
         // checking and getting the index of columns
@@ -262,112 +4855,164 @@ public:
             return;
         }
         // update columns
-        for(auto& row: rows){
-            if(row[matchColumnIndex] == matchValue){
-                row[updateColumnIndex] = newValue;
+        for(size_t row = 0; row < rowCount; ++row){
+            if(data[matchColumnIndex].equals(row, matchValue)){
+                setCell(row, updateColumnIndex, newValue);
             }
         }
+        logChanges(lock);
         std::cout << "Rows updated where " << columnName << " == " << matchValue << std::endl;
     }
 
+    // Write the table in the binary page format (see TABLE_FILE_MAGIC)
     void saveToFile(const std::string& filename){
-        std::ofstream outFile(filename);
+        if (!isSnapshot) return snapshot()->saveToFile(filename);
 
-        if(outFile.is_open()){
-            // write the table name
-            outFile << tableName << std::endl;
+        if(writeTableFile(filename)){
+            std::cout << "Data saved to " << filename << std::endl;
+        }
+    }
+
+    // Open a write-ahead log for the table and replay the records in it that
+    // the rows do not include yet. Load the table file first, then open its
+    // log; from then on every change is logged before the mutator returns.
+    bool openLog(const std::string& logFile, Durability level = Durability::SYNCED){
+        auto lock = writeLock();
+
+        if(wal){
+            std::cout << "Error: Table " << tableName << " already has a log open." << std::endl;
+            return false;
+        }
+
+        auto log = std::make_unique<WriteAheadLog>();
+        std::vector<std::string> records;
+        std::string error;
+        if(!log->open(logFile, records, error)){
+            std::cout << "Error: " << error << std::endl;
+            return false;
+        }
 
-            // write col name
-            for(const auto& col : columns){
-                outFile << col << "\t";
+        size_t replayed = 0;
+        replaying = true;
+        for(const auto& record : records){
+            uint64_t before = logSequence;
+            if(!replayRecord(record, error)){
+                replaying = false;
+                std::cout << "Error: Recovery from " << logFile << " stopped: " << error << std::endl;
+                return false;
             }
+            if(logSequence != before) replayed++;
+        }
+        replaying = false;
 
-            outFile << std::endl;
+        wal = std::move(log);
+        durability = level;
+        redo.clear();
+        std::cout << "Log " << logFile << " opened, " << replayed << " records replayed." << std::endl;
+        return true;
+    }
 
-            //write rows
-            for(const auto& row : rows){
-                for(const auto& data: row){
-                    outFile << data << "\t";
-                }
-                outFile << std::endl;
-            }
+    void setDurability(Durability level){
+        auto lock = writeLock();
+        durability = level;
+    }
 
-            outFile.close();
-            std::cout << "Data saved to " << filename << std::endl;
+    // Limit the working memory of sortTable and sortRows; larger sorts
+    // spill to temporary files. 0 sorts in memory. A budget below what
+    // reordering the table itself takes (two positions per row and a copy
+    // of the largest column) still sorts, in runs of 1024 rows.
+    void setSortMemory(size_t bytes){
+        auto lock = writeLock();
+        sortMemory = bytes;
+    }
 
-        }else {
-            std::cout << "Error: Unable to open file for writing." << std::endl;
+    // Cap the threads used by scans, and choose whether their results keep
+    // table order. Snapshots taken afterwards use the same options.
+    void setScanOptions(const ScanOptions& options){
+        auto lock = writeLock();
+        scanOptions = options;
+    }
+
+    // Save the table with every logged change and empty the log. The file is
+    // written beside fileName and renamed over it, so a crash leaves either
+    // the old file with the whole log or the new file; records already in
+    // the file are skipped when the log is replayed.
+    bool checkpoint(const std::string& fileName){
+        auto lock = writeLock();
+
+        std::string temporary = fileName + ".tmp";
+        if(!writeTableFile(temporary)) return false;
+        if(!syncFile(temporary) || !replaceFile(temporary, fileName)){
+            std::cout << "Error: Unable to replace " << fileName << std::endl;
+            return false;
+        }
+        if(wal && !wal->reset()){
+            std::cout << "Error: Unable to truncate the log of table " << tableName << std::endl;
+            return false;
         }
+        std::cout << "Checkpoint written to " << fileName << std::endl;
+        return true;
     }
 
     void deleteRows(const std::string& columnName, const std::string& value){
-        std::lock_guard<std::mutex> lock(tableMutex);  
+        auto lock = writeLock();  
 
         int columnIndex = colunmFind(columnName);
 
-        // itreate over the rows and delete matching one
-        for(auto it = rows.begin(); it != rows.end();){
-            if ((*it)[columnIndex] == value) {
-                it = rows.erase(it);  // Remove the row and get a new iterator
-            } else {
-                ++it;  // Move to the next row
+        // collect the matching rows and delete them in one pass
+        std::vector<size_t> matches;
+        for(size_t row = 0; row < rowCount; ++row){
+            if (data[columnIndex].equals(row, value)) {
+                matches.push_back(row);
             }
-
-            std::cout << "Rows deleted where " << columnName << " == " << value << std::endl;
         }
+        eraseRowData(matches);
+        logChanges(lock);
+
+        std::cout << "Rows deleted where " << columnName << " == " << value << std::endl;
     }
 
+    // Load a table written by saveToFile. The file is memory mapped and the
+    // column chunks are copied straight into blocks. Files in the older
+    // tab-separated text format are still read.
     void loadFromFile(const std::string& fileName){
-        std::ifstream inFile(fileName);
-
-        if(inFile.is_open()){
-            std::string line;
-
-            // clear existing row (incase we are loading into existing table)
-            rows.clear();
-
-            // read table name
-            std::getline(inFile, tableName);
-
-            // read and skip the columns
-            std::getline(inFile, line);
+        auto lock = writeLock();
+        MappedFile file(fileName);
 
-            // read each row of data
-            while(std::getline(inFile, line)){
-                std::stringstream ss(line);
-                std::vector<std::string> rowData;
-                std::string data;
-                while(ss >> data){
-                    rowData.push_back(data);
-                }
-                rows.push_back(rowData);
-            }
-
-            inFile.close();
+        if(!file.isOpen()){
+            std::cout << "Error: Unable to open file for reading." << std::endl;
+            return;
+        }
+        if(file.size() < sizeof(TABLE_FILE_MAGIC) || std::memcmp(file.data(), TABLE_FILE_MAGIC, sizeof(TABLE_FILE_MAGIC)) != 0){
+            loadTextFile(fileName);
+            logChanges(lock);
+            return;
+        }
 
+        std::string error;
+        if(loadPages(file, error)){
+            logChanges(lock);
             std::cout << "Data loaded from " << fileName << std::endl;
         } else {
-            std::cout << "Error: Unable to open file for reading." << std::endl;
+            std::cout << "Error: Cannot load " << fileName << ": " << error << std::endl;
         }
     }
 
     void sortRows(const std::string& columnName, bool ascending = true){
+        auto lock = writeLock();
        int columnIndex = colunmFind(columnName);
 
         // Sort the rows based on the selected column
-        std::sort(rows.begin(), rows.end(), [columnIndex, ascending](const std::vector<std::string>& row1, const std::vector<std::string>& row2) {
-            if (ascending) {
-                return row1[columnIndex] < row2[columnIndex];  // Ascending order
-            } else {
-                return row1[columnIndex] > row2[columnIndex];  // Descending order
-            }
-        });
+        permuteRowData(externalSortedOrder({static_cast<size_t>(columnIndex)}, {ascending}));
+        logChanges(lock);
 
         std::cout << "Rows sorted by column '" << columnName << "' in " << (ascending ? "ascending" : "descending") << " order." << std::endl;
     }
 
     size_t countRows() const {
-        return rows.size();
+        std::shared_lock<std::shared_mutex> lock(tableMutex, std::defer_lock);
+        acquire(lock, lockCounters.sharedAcquired);
+        return rowCount;
     }
 
     // double sumColumn(const std::string& columnName){
@@ -416,6 +5061,8 @@ public:
     // }
 
     double averageColumn(const std::string& columnName) {
+        if (!isSnapshot) return snapshot()->averageColumn(columnName);
+
         double sum = sumColumn(columnName);
         size_t count = countRows();
         return (count > 0) ? sum / count : 0;
@@ -432,82 +5079,93 @@ public:
     }
 
     void rollback(){
+        auto lock = writeLock();
         if(!inTransaction){
             std::cout << "No active transaction to rollback." << std::endl;
             return;
         }
-        rows = transactionBackup;
+        resetStorage();
+        for(const auto& row : transactionBackup){
+            appendRowData(row);
+        }
         transactionBackup.clear();
+        logChanges(lock);
         std::cout<< "Transaction rolled back." << std::endl;
     };
 
     std::vector<std::string> queryByIdAndAge(const std::string& id, const std::string& age){
-        std::lock_guard<std::mutex> lock(tableMutex); 
+        ReadLock lock = readLock();
 
         auto it = multiColumnIndex.find(std::make_tuple(id, age));
         if(it != multiColumnIndex.end()){
-            return rows[it->second];
+            return rowAt(it->second.back());  // the latest row with this key
         }else {
              std::cout << "No row found with ID == " << id << " and Age == " << age << std::endl;
             return {};
         }
     }
 
-    std::vector<std::vector<std::string>> join(const Table& otherTable, const std::string& columnName){
-        std::lock_guard<std::mutex> lock(tableMutex); 
-
-        size_t thisColunIndex = -1;
-        size_t otherColunIndex = -1;
-
-        for(size_t i=0; i < columns.size(); i++){
-            if(columns[i] == columnName){
-                thisColunIndex = i;
-                break;
-            }
-        }
-
-        for(size_t i = 0; i < otherTable.columns.size(); i++){
-            if(otherTable.columns[i] == columnName){
-                otherColunIndex = i;
-                break;
-            }
-        }
-
-        if(thisColunIndex == -1 || otherColunIndex == -1){
-            std::cout << "Error: Column '" << columnName << "' not found in one or both tables." << std::endl;
-            return {};
+    // Names of the columns in join() rows: ours, then the other table's
+    // without its join column. A name we already have is qualified with
+    // the other table's name.
+    std::vector<std::string> joinColumns(const Table& otherTable, const std::string& columnName) const {
+        std::vector<std::string> names = columns;
+        for (const auto& name : otherTable.columns) {
+            if (name == columnName) continue;
+            bool clash = std::find(columns.begin(), columns.end(), name) != columns.end();
+            names.push_back(clash ? otherTable.tableName + "." + name : name);
         }
+        return names;
+    }
 
-
-        // Vector to store the result of the join
-        std::vector<std::vector<std::string>> result;
-
-        // perfom the join: itreate through this table's rows
-        for(const auto& thisRow : rows){
-            // Itreate through the other table's rows
-            for(const auto& otherRow : otherTable.rows){
-                // If the join column matches in both tables, combine the row
-                if(thisRow[thisColunIndex] == otherRow[otherColunIndex]){
-                    std::vector<std::string> joinedRow = thisRow;
-                    // add colums from current table to this
-                    joinedRow.insert(joinedRow.end(), otherRow.begin(), otherRow.end());
-
-                    // add columms from the other table, skipping the join column to avoid duplication
-                    for(size_t i=0; i < otherRow.size(); i++){
-                        if(i != otherColunIndex){
-                            joinedRow.push_back(otherRow[i]);
-                        }
-                    }
-
-                    // add the combined row to the result
-                    result.push_back(joinedRow);
-                }
+    // Equi-join with otherTable on columnName; see joinColumns for the row
+    // layout. LEFT_OUTER also returns our rows without a match, with empty
+    // cells for the other table. A hash join keeps our row order; a
+    // sort-merge join returns the rows in key order. AUTO merges when both
+    // inputs already come in key order (a B+tree index on the column, or
+    // rows stored sorted) and hashes otherwise.
+    // Large hash joins are radix partitioned and run in parallel. When
+    // timings is given it receives the time spent in each phase.
+    std::vector<std::vector<std::string>> join(const Table& otherTable, const std::string& columnName,
+                                               JoinType type = JoinType::INNER, JoinMethod method = JoinMethod::AUTO,
+                                               JoinTimings* timings = nullptr){
+        using Clock = std::chrono::steady_clock;
+        auto millisSince = [](Clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+        JoinInput left, right;
+        std::vector<std::pair<size_t, size_t>> pairs;
+        JoinTimings phases;
+        if (!joinPairs(otherTable, columnName, type, method, left, right, pairs, phases)) return {};
+        const Table& leftRows = *left.rows;
+        const Table& rightRows = *right.rows;
+
+        // Materialize: our cells, then the other table's without the join column
+        auto start = Clock::now();
+        std::vector<std::vector<std::string>> result(pairs.size());
+        const size_t ROWS_PER_TASK = 16384;
+        ThreadPool::shared().parallelFor((pairs.size() + ROWS_PER_TASK - 1) / ROWS_PER_TASK, [&](size_t task) {
+            size_t end = std::min(pairs.size(), (task + 1) * ROWS_PER_TASK);
+            for (size_t k = task * ROWS_PER_TASK; k < end; ++k) {
+                joinedRow(leftRows, rightRows, right.column, pairs[k].first, pairs[k].second, result[k]);
             }
-        }
+        });
+        phases.materialize = millisSince(start);
 
+        if (timings) *timings = phases;
         return result;
     }
 
+    // join() as a cursor: the rows are built a batch at a time as they are
+    // read instead of all at once. An unknown column gives an empty cursor.
+    JoinCursor openJoinCursor(const Table& otherTable, const std::string& columnName,
+                              JoinType type = JoinType::INNER, JoinMethod method = JoinMethod::AUTO) const {
+        JoinCursor cursor;
+        JoinTimings phases;
+        if (!joinPairs(otherTable, columnName, type, method, cursor.left, cursor.right, cursor.pairs, phases)) cursor.pairs.clear();
+        return cursor;
+    }
+
     // single col
     // void sortTable(const std::string& columnName, bool ascending = true){
     //     std::lock_guard<std::mutex> lock(tableMutex);
@@ -535,7 +5193,7 @@ public:
     // }
 
     void sortTable(const std::vector<std::string>& columnNames, const std::vector<bool>& ascendingFlags) {
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
+        auto lock = writeLock();  // Lock for concurrency
 
         // Find the indices of the columns to sort by
         std::vector<size_t> columnIndices;
@@ -557,21 +5215,8 @@ public:
         }
 
         // Sort the rows based on multiple columns
-        std::sort(rows.begin(), rows.end(), [columnIndices, ascendingFlags](const std::vector<std::string>& row1, const std::vector<std::string>& row2) {
-            for (size_t i = 0; i < columnIndices.size(); ++i) {
-                size_t columnIndex = columnIndices[i];
-                bool ascending = ascendingFlags[i];
-
-                if (row1[columnIndex] != row2[columnIndex]) {
-                    if (ascending) {
-                        return row1[columnIndex] < row2[columnIndex];
-                    } else {
-                        return row1[columnIndex] > row2[columnIndex];
-                    }
-                }
-            }
-            return false;  // If all specified columns are equal, maintain the original order
-        });
+        permuteRowData(externalSortedOrder(columnIndices, ascendingFlags));
+        logChanges(lock);
 
         std::cout << "Table sorted by columns: ";
         for (const auto& columnName : columnNames) {
@@ -581,7 +5226,7 @@ public:
     }
 
     double sumColumn(const std::string& columnName){
-        std::lock_guard<std::mutex> lock(tableMutex);
+        if (!isSnapshot) return snapshot()->sumColumn(columnName);
 
         size_t columnIndex = -1;
         for (size_t i = 0; i < columns.size(); i++) {
@@ -598,18 +5243,30 @@ public:
 
         double sum = 0.0;
 
-        for(const auto& row : rows){
-            try{
-                sum += std::stod(row[columnIndex]); // convert string to double and add to sum
-            } catch (const std::invalid_argument&) {
-                std::cout << "Skipping non-numeric value: " << row[columnIndex] << std::endl;
+        const Column& column = data[columnIndex];
+        if (!column.isText() && column.getType() == DataType::INTEGER) {
+            // Typed integers: add the stored values block by block
+            for (const auto& block : column.getBlocks()) {
+                for (int64_t value : block->values) {
+                    sum += static_cast<double>(value);
+                }
+            }
+            return sum;
+        }
+
+        for(size_t row = 0; row < rowCount; ++row){
+            double value;
+            if (numericCell(columnIndex, row, value)) {
+                sum += value;
+            } else {
+                std::cout << "Skipping non-numeric value: " << column.get(row) << std::endl;
             }
         }
         return sum;
     }
 
     double avgColumn(const std::string& columnName) {
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
+        if (!isSnapshot) return snapshot()->avgColumn(columnName);
 
         size_t columnIndex = -1;
         for (size_t i = 0; i < columns.size(); i++) {
@@ -626,19 +5283,20 @@ public:
 
         double sum = 0.0;
         int count = 0;
-        for (const auto& row : rows) {
-            try {
-                sum += std::stod(row[columnIndex]);
+        for (size_t row = 0; row < rowCount; ++row) {
+            double value;
+            if (numericCell(columnIndex, row, value)) {
+                sum += value;
                 count++;
-            } catch (const std::invalid_argument&) {
-                std::cout << "Skipping non-numeric value: " << row[columnIndex] << std::endl;
+            } else {
+                std::cout << "Skipping non-numeric value: " << data[columnIndex].get(row) << std::endl;
             }
         }
         return count == 0 ? 0 : sum / count;
     }
 
     double minColumn(const std::string& columnName) {
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
+        ReadLock lock = readLock();  // Lock for concurrency
 
         size_t columnIndex = -1;
         for (size_t i = 0; i < columns.size(); i++) {
@@ -653,22 +5311,38 @@ public:
             return 0;
         }
 
+        // Every cell of a typed INTEGER column is numeric, so a B+tree on it
+        // answers directly from its leftmost leaf
+        const Index* tree = findUsableIndex(columnIndex, IndexType::BTREE);
+        if (tree && tree->typedKeys && data[columnIndex].getType() == DataType::INTEGER) {
+            BPlusTree<int64_t>::Entry entry;
+            return tree->typedTree.first(entry) ? static_cast<double>(entry.key) : 0;
+        }
+        if (!isSnapshot) {
+            std::unique_ptr<Table> view = snapshotLocked();
+            lock.unlock();
+            return view->minColumn(columnName);
+        }
+
+        double low, high;
+        if (typedRange(columnIndex, low, high)) return low;
+
         double minValue = std::numeric_limits<double>::max();
         bool foundNumeric = false;
-        for (const auto& row : rows) {
-            try {
-                double value = std::stod(row[columnIndex]);
+        for (size_t row = 0; row < rowCount; ++row) {
+            double value;
+            if (numericCell(columnIndex, row, value)) {
                 minValue = std::min(minValue, value);
                 foundNumeric = true;
-            } catch (const std::invalid_argument&) {
-                std::cout << "Skipping non-numeric value: " << row[columnIndex] << std::endl;
+            } else {
+                std::cout << "Skipping non-numeric value: " << data[columnIndex].get(row) << std::endl;
             }
         }
         return foundNumeric ? minValue : 0;  // Return 0 if no numeric values were found
     }
 
     double maxColumn(const std::string& columnName) {
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
+        ReadLock lock = readLock();  // Lock for concurrency
 
         size_t columnIndex = -1;
         for (size_t i = 0; i < columns.size(); i++) {
@@ -683,22 +5357,39 @@ public:
             return 0;
         }
 
+        // Every cell of a typed INTEGER column is numeric, so a B+tree on it
+        // answers directly from its rightmost leaf
+        const Index* tree = findUsableIndex(columnIndex, IndexType::BTREE);
+        if (tree && tree->typedKeys && data[columnIndex].getType() == DataType::INTEGER) {
+            BPlusTree<int64_t>::Entry entry;
+            return tree->typedTree.last(entry) ? static_cast<double>(entry.key) : 0;
+        }
+        if (!isSnapshot) {
+            std::unique_ptr<Table> view = snapshotLocked();
+            lock.unlock();
+            return view->maxColumn(columnName);
+        }
+
+        double low, high;
+        if (typedRange(columnIndex, low, high)) return high;
+
         double maxValue = std::numeric_limits<double>::lowest();
         bool foundNumeric = false;
-        for (const auto& row : rows) {
-            try {
-                double value = std::stod(row[columnIndex]);
+        for (size_t row = 0; row < rowCount; ++row) {
+            double value;
+            if (numericCell(columnIndex, row, value)) {
                 maxValue = std::max(maxValue, value);
                 foundNumeric = true;
-            } catch (const std::invalid_argument&) {
-                std::cout << "Skipping non-numeric value: " << row[columnIndex] << std::endl;
+            } else {
+                std::cout << "Skipping non-numeric value: " << data[columnIndex].get(row) << std::endl;
             }
         }
         return foundNumeric ? maxValue : 0;  // Return 0 if no numeric values were found
     }
 
-    std::vector<std::vector<std::string>> filterRows(const std::string& columnName, const std::string& op, const std::string& value){
-        std::lock_guard<std::mutex> lock(tableMutex);
+    std::vector<std::vector<std::string>> filterRows(const std::string& columnName, const std::string& op, const std::string& value,
+                                                     const std::vector<std::string>& projection = {}){
+        ReadLock lock = readLock();
 
         size_t columnIndex = -1;
         for(size_t i = 0; i< columns.size(); i++){
@@ -713,94 +5404,50 @@ public:
             return {};
         }
 
-        // Vector to store filtered rows
-        std::vector<std::vector<std::string>> result;
-
-        for(const auto& row : rows){
-            bool conditionMet = false;
-            try {
-                // convert the row data and filters value to double if it's a numeric comparison
-                double rowValue = std::stod(row[columnIndex]);
-                double filterValue = std::stod(value);
-
-                if(op == "==") conditionMet = (rowValue == filterValue);
-                else if (op == "!=") conditionMet = (rowValue != filterValue);
-                else if (op == "<") conditionMet = (rowValue < filterValue);
-                else if (op == ">") conditionMet = (rowValue > filterValue);
-                else if (op == "<=") conditionMet = (rowValue <= filterValue);
-                else if (op == ">=") conditionMet = (rowValue >= filterValue);
-            } catch (const std::invalid_argument&) {
-                // Handle string comparisons
-                if (op == "==") conditionMet = (row[columnIndex] == value);
-                else if (op == "!=") conditionMet = (row[columnIndex] != value);
-            }
+        std::vector<size_t> outputColumns;
+        if (!projectColumns(projection, outputColumns)) return {};
 
-             // If the condition is met, add the row to the result
-            if (conditionMet) {
-                result.push_back(row);
-            }
-        }
-        return result;
+        PredicatePlan plan;
+        plan.root = compileLeaf(plan, columnIndex, op, value);
+        return readMatches(lock, plan, outputColumns);
     }
 
     std::map<std::string, double> groupedAggregation(const std::string& groupByColumn, const std::string& aggColumn, const std::string& aggType){
-    
-        // Find the indices of the columns
-        size_t groupByIndex = -1, aggColumnIndex = -1;
-        for (size_t i = 0; i < columns.size(); i++) {
-            if (columns[i] == groupByColumn) groupByIndex = i;
-            if (columns[i] == aggColumn) aggColumnIndex = i;
-        }
+        if (!isSnapshot) return snapshot()->groupedAggregation(groupByColumn, aggColumn, aggType);
 
-        if (groupByIndex == -1 || aggColumnIndex == -1) {
+        if (findColumnIndex(groupByColumn) == static_cast<size_t>(-1) || findColumnIndex(aggColumn) == static_cast<size_t>(-1)) {
             std::cout << "Error: Invalid column name(s)." << std::endl;
             return {};
         }
-
-        // Map to store the groups and aggregation values
-        std::map<std::string, std::vector<double>> groups;
-
-        // Group the rows based on the grouping column
-        for (const auto& row : rows){
-            const std::string& groupValue = row[groupByIndex];
-            // attempt to convert the aggregation column value to double
-            try{
-                double value = std::stod(row[aggColumnIndex]);
-                groups[groupValue].push_back(value); // add value to the group
-            } catch (const std::invalid_argument&){
-                std::cout << "Skipping non-numeric value in aggregation column: " << row[aggColumnIndex] << std::endl;
-            }
+        if (aggType != "SUM" && aggType != "AVG" && aggType != "MIN" && aggType != "MAX") {
+            std::cout << "Error: Invalid aggregation type." << std::endl;
+            return {};
         }
 
-        // Map to store the final aggregation result for each group
-        std::map<std::string, double> result;
-
-        // calculate the specified aggregation for each group
-        for(const auto& group : groups){
-            const std::string& groupKey = group.first;
-            const std::vector<double>& values = group.second;
-            double aggregationValue = 0.0;
-
-             if (aggType == "SUM") {
-                aggregationValue = std::accumulate(values.begin(), values.end(), 0.0);
-            } else if (aggType == "AVG") {
-                aggregationValue = values.empty() ? 0 : std::accumulate(values.begin(), values.end(), 0.0) / values.size();
-            } else if (aggType == "MIN") {
-                aggregationValue = *std::min_element(values.begin(), values.end());
-            } else if (aggType == "MAX") {
-                aggregationValue = *std::max_element(values.begin(), values.end());
-            } else {
-                std::cout << "Error: Invalid aggregation type." << std::endl;
-                return {};
-            }
+        std::vector<AggregateOp> ops;
+        std::vector<size_t> slots;
+        GroupAggregator aggregator = aggregateGroups({groupByColumn}, {{aggColumn, aggType}}, ops, slots);
 
-            result[groupKey] = aggregationValue;
+        // Map to store the final aggregation result for each group; groups
+        // without a numeric value are left out
+        std::map<std::string, double> result;
+        uint64_t skipped = 0;
+        for (size_t group = 0; group < aggregator.groups(); ++group) {
+            const AggregateState& state = aggregator.state(group, 0);
+            skipped += aggregator.rowCounts[group] - state.count;
+            double aggregationValue;
+            if (state.result(ops[0], aggregationValue)) result[groupCell(aggregator, group, 0)] = aggregationValue;
+        }
+        if (skipped > 0) {
+            std::cout << "Skipped " << skipped << " non-numeric values in aggregation column " << aggColumn << std::endl;
         }
 
         return result;
     }
 
     void conditionUpdateRow(const std::string& targetColumn, const std::string& newValue, const std::string& conditionColumn, const std::string& op, const std::string& conditionValue){
+        auto lock = writeLock();
+
         // Find indices of the target and condition columns
         size_t targetIndex = -1, conditionIndex = -1;
         for (size_t i = 0; i < columns.size(); i++) {
@@ -814,41 +5461,20 @@ public:
         }
 
         // update rows that match the condition
-        for(auto& row : rows){
-            bool conditionMet = false;
-            try
-            {
-                // Try to convert the condition value and the row value to double for numeric comparison
-                double rowValue = std::stod(row[conditionIndex]);
-                double condValue = std::stod(conditionValue);
-
-                if (op == "==") conditionMet = (rowValue == condValue);
-                else if (op == "!=") conditionMet = (rowValue != condValue);
-                else if (op == "<") conditionMet = (rowValue < condValue);
-                else if (op == ">") conditionMet = (rowValue > condValue);
-                else if (op == "<=") conditionMet = (rowValue <= condValue);
-                else if (op == ">=") conditionMet = (rowValue >= condValue);
-
-            }
-            catch(const std::invalid_argument&)
-            {
-                // Handle string comparison if values are non-numeric
-                if (op == "==") conditionMet = (row[conditionIndex] == conditionValue);
-                else if (op == "!=") conditionMet = (row[conditionIndex] != conditionValue);
-            }
-
-            if(conditionMet){
-                row[targetIndex] = newValue;
-                std::cout<< "Updated row: ";
-                for(const auto& value : row){
-                    std::cout<<value<<"\t";
-                }  
-                std::cout << std::endl;
-            }
+        for(size_t row : matchRows(conditionIndex, op, conditionValue)){
+            setCell(row, targetIndex, newValue);
+            std::cout<< "Updated row: ";
+            for(const auto& value : rowAt(row)){
+                std::cout<<value<<"\t";
+            }  
+            std::cout << std::endl;
         }
+        logChanges(lock);
     }
 
     void conditionDeleteRow(const std::string& conditionColumn, const std::string& op, const std::string& conditionValue){
+        auto lock = writeLock();
+
         // Find the index of the condition column
         size_t conditionIndex = -1;
         for (size_t i = 0; i < columns.size(); i++) {
@@ -863,116 +5489,129 @@ public:
             return;
         }
 
-        for(auto it = rows.begin(); it!=rows.end();){
-            bool conditionMet = false;
-            try
-            {
-                // Try to convert the condition value and the row value to double for numeric comparison
-                double rowValue = std::stod((*it)[conditionIndex]);
-                double condValue = std::stod(conditionValue);
-
-                if (op == "==") conditionMet = (rowValue == condValue);
-                else if (op == "!=") conditionMet = (rowValue != condValue);
-                else if (op == "<") conditionMet = (rowValue < condValue);
-                else if (op == ">") conditionMet = (rowValue > condValue);
-                else if (op == "<=") conditionMet = (rowValue <= condValue);
-                else if (op == ">=") conditionMet = (rowValue >= condValue);
-            } catch (const std::invalid_argument&) {
-                // Handle string comparison if values are non-numeric
-                if (op == "==") conditionMet = ((*it)[conditionIndex] == conditionValue);
-                else if (op == "!=") conditionMet = ((*it)[conditionIndex] != conditionValue);
-            }
-
-            // If the condition is met, delete the row and move the iterator to the next element
-            if(conditionMet) {
-                std::cout << "Deleting row: ";
-                for(const auto& value : *it){
-                    std::cout << value << "\t";
-                }
-                std::cout << std::endl;
-                it = rows.erase(it);
-            }else {
-              ++it;  
+        std::vector<size_t> matches = matchRows(conditionIndex, op, conditionValue);
+        for(size_t row : matches){
+            std::cout << "Deleting row: ";
+            for(const auto& value : rowAt(row)){
+                std::cout << value << "\t";
             }
-            
+            std::cout << std::endl;
         }
+
+        // Remove all matching rows in one pass over the columns
+        eraseRowData(matches);
+        logChanges(lock);
     }
 
-    void exportToCSV(const std::string& fileName){
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
+    // Export to CSV with RFC 4180 quoting, from a snapshot so writers carry
+    // on meanwhile. Worker threads format ranges of rows into buffers that
+    // one writer writes out in order.
+    void exportToCSV(const std::string& fileName, char delimiter = ','){
+        if (!isSnapshot) return snapshot()->exportToCSV(fileName, delimiter);
 
         // open the file for writing 
-        std::ofstream outFile(fileName);
+        std::ofstream outFile(fileName, std::ios::binary);
         if(!outFile.is_open()){
             std::cout << "Error: Could not open file " << fileName << " for writing." << std::endl;
             return;
         }
 
+        std::string header;
         for(size_t i = 0; i < columns.size(); i++){
-            outFile << columns[i];
-            if(i < columns.size() -1) outFile << "," ; // Add comma between columns
+            if(i > 0) header.push_back(delimiter);
+            appendCsvField(header, columns[i], delimiter);
         }
-        outFile << "\n"; // Newline after headers
-
-        // write each row
-        for(const auto& row : rows){
-            for(size_t i = 0; i < row.size(); ++i){
-                outFile << row[i];
-                if(i < row.size() - 1) outFile << ","; // Add comma between columns
-            }
-            outFile << "\n";
+        header.push_back('\n');
+        outFile.write(header.data(), header.size());
+
+        // Format a batch of row ranges in parallel, then write it
+        ThreadPool& pool = ThreadPool::shared();
+        size_t ranges = (rowCount + EXPORT_ROWS - 1) / EXPORT_ROWS;
+        size_t batchSize = std::max<size_t>(1, pool.size() * 2);
+        std::vector<std::string> buffers(batchSize);
+        for(size_t first = 0; first < ranges && outFile; first += batchSize){
+            size_t batch = std::min(batchSize, ranges - first);
+            pool.parallelFor(batch, [&](size_t k) {
+                size_t begin = (first + k) * EXPORT_ROWS;
+                formatCsvRows(begin, std::min(rowCount, begin + EXPORT_ROWS), delimiter, buffers[k]);
+            }, scanOptions.maxThreads);
+            for(size_t k = 0; k < batch; ++k) outFile.write(buffers[k].data(), buffers[k].size());
         }
 
         outFile.close();
+        if(!outFile){
+            std::cout << "Error: Writing " << fileName << " failed." << std::endl;
+            return;
+        }
         std::cout << "Table data successfully exported to " << fileName << std::endl;
     }
+
+    // Export with tabs between fields; fields are quoted as in exportToCSV
+    void exportToTSV(const std::string& fileName){
+        exportToCSV(fileName, '\t');
+    }
     
+    // Import a CSV file (RFC 4180 quoting). The file is mapped and split
+    // at record boundaries into chunks that are parsed in parallel, each
+    // straight into typed columns, and then appended in file order.
     void importFromCSV(const std::string& filename, bool clearExisingData = true){
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
+        auto lock = writeLock();  // Lock for concurrency
 
         // open file for reading
-        std::ifstream inFile(filename);
-        if(!inFile.is_open()){
+        MappedFile file(filename);
+        if(!file.isOpen()){
             std::cout << "Error: Could not open file " << filename << " for reading." << std::endl;
             return;
         }
-
-        if(clearExisingData){
-            columns.clear();
-            rows.clear();
-        }
-
-        std::string line;
+        const char* begin = file.data();
+        const char* end = begin + file.size();
 
         // Read the column headers (first row of csv)
-        if(std::getline(inFile, line)){
-            std::stringstream ss(line);
-            std::string column;
-            while(std::getline(ss, column, ',')){
-                columns.push_back(column);
+        CsvReader headerReader(begin, end);
+        std::vector<std::string_view> fields;
+        if(!headerReader.atEnd()){
+            headerReader.next(fields);
+            if(clearExisingData){
+                std::vector<std::string> header(fields.begin(), fields.end());
+
+                // Keep the column types when the file has the same shape as the table
+                if(header.size() != columns.size()){
+                    columnTypes.assign(header.size(), DataType::STRING);
+                }
+                columns = header;
+                resetStorage();
             }
+            begin += countCsvRecordBytes(begin, end);
         }
 
-        // Read each row of data        
-        while (std::getline(inFile, line)){
-            std::stringstream ss(line);
-            std::string value;
-            std::vector<std::string> row;
-
-            while (std::getline(ss, value, ',')){
-                row.push_back(value);
-            }
-
-            // Ensure the row has the correcty number of columns
-            if(row.size() == columns.size()){
-                rows.push_back(row);
-            } else {
-                std::cout << "Warning: Row has incorrect number of columns and will be skipped." << std::endl;
-            }
+        // Parse the chunks, then append them in order
+        std::vector<const char*> bounds = csvChunkBounds(begin, end);
+        std::vector<CsvChunk> chunks(bounds.size() - 1);
+        ThreadPool& pool = ThreadPool::shared();
+        pool.parallelFor(chunks.size(), [&](size_t c) { parseCsvChunk(bounds[c], bounds[c + 1], chunks[c]); }, scanOptions.maxThreads);
+
+        size_t firstRow = rowCount;
+        uint64_t skipped = 0, invalid = 0;
+        pool.parallelFor(data.size(), [&](size_t i) {
+            for (const auto& chunk : chunks) data[i].appendColumn(chunk.columns[i]);
+        }, scanOptions.maxThreads);
+        for (const auto& chunk : chunks) {
+            rowCount += chunk.rows;
+            skipped += chunk.skipped;
+            invalid += chunk.invalid;
+        }
+        chunks.clear();
+        indexAppendedRows(firstRow);
 
+        if (skipped > 0) {
+            std::cout << "Warning: " << skipped << " rows had an incorrect number of columns and were skipped." << std::endl;
         }
-        inFile.close();  // Close the file
-        std::cout << "Table data successfully imported from " << filename << std::endl;
+        if (invalid > 0) {
+            std::cout << "Warning: " << invalid << " cells did not match their column type and are stored as text." << std::endl;
+        }
+        size_t imported = rowCount - firstRow;
+        logChanges(lock);
+        std::cout << "Table data successfully imported from " << filename << " (" << imported << " rows)" << std::endl;
     }
 
     // single condtion
@@ -1034,29 +5673,8 @@ public:
             return false;
         }
 
-        // Extract the row value to compare
-        const std::string& rowValue = row[columnIndex];
-        bool conditionMet = false;
-
         // Handle numeric and string comparisons
-        try {
-            double rowValueNumeric = std::stod(rowValue); // Try converting to double for numeric comparison
-            double conditionValueNumeric = std::stod(condition.value); // Convert the condition value to double
-
-            // Perform numeric comparisons based on the operator
-            if (condition.op == "==") conditionMet = (rowValueNumeric == conditionValueNumeric);
-            else if (condition.op == "!=") conditionMet = (rowValueNumeric != conditionValueNumeric);
-            else if (condition.op == "<") conditionMet = (rowValueNumeric < conditionValueNumeric);
-            else if (condition.op == ">") conditionMet = (rowValueNumeric > conditionValueNumeric);
-            else if (condition.op == "<=") conditionMet = (rowValueNumeric <= conditionValueNumeric);
-            else if (condition.op == ">=") conditionMet = (rowValueNumeric >= conditionValueNumeric);
-        } catch (const std::invalid_argument&) {
-            // If conversion fails, assume it's a string comparison
-            if (condition.op == "==") conditionMet = (rowValue == condition.value);
-            else if (condition.op == "!=") conditionMet = (rowValue != condition.value);
-        }
-
-        return conditionMet;
+        return compareText(row[columnIndex], condition.op, condition.value);
     }
 
 
@@ -1094,54 +5712,56 @@ public:
         return groupResult;
     }
 
-    std::vector<std::vector<std::string>> searchRowMultiple(const ConditionGroup& group) {
-        std::lock_guard<std::mutex> lock(tableMutex);  // Lock for concurrency
-
-        std::vector<std::vector<std::string>> result;
-
-        for (const auto& row : rows) {
-            if (evaluateConditionGroup(group, row, columns)) {
-                result.push_back(row);
-            }
-        }
-
-        return result;
+    // searchRowMultiple, searchRows, searchRowsBetween and the searchRowsCondition
+    // functions take a projection list like selectRows
+    std::vector<std::vector<std::string>> searchRowMultiple(const ConditionGroup& group, const std::vector<std::string>& projection = {}) {
+        ReadLock lock = readLock();  // Lock for concurrency
+        std::vector<size_t> outputColumns;
+        if (!projectColumns(projection, outputColumns)) return {};
+        return readMatches(lock, compilePredicate(group), outputColumns);
     }
 
     // search with indexing
-    std::vector<std::vector<std::string>> searchRows(const std::vector<Condition>& conditions, const std::string& logicalOp = "AND") {
-        std::lock_guard<std::mutex> lock(tableMutex);
+    std::vector<std::vector<std::string>> searchRows(const std::vector<Condition>& conditions, const std::string& logicalOp = "AND",
+                                                     const std::vector<std::string>& projection = {}) {
+        ReadLock lock = readLock();
+        std::vector<size_t> outputColumns;
+        if (!projectColumns(projection, outputColumns)) return {};
+
+        ConditionGroup group;
+        group.conditions = conditions;
+        group.logicalOp = logicalOp;
+        return readMatches(lock, compilePredicate(group), outputColumns);
+    }
 
-        // Vector to store matching rows
-        std::vector<std::vector<std::string>> result;
-        
-        // Check for index-based optimization
-        for (const auto& condition : conditions) {
-            // Look for an index on the condition's column
-            auto indexIt = std::find_if(indexes.begin(), indexes.end(),
-                [&condition](const Index& idx) { return idx.column == condition.column; });
-
-            if (indexIt != indexes.end() && condition.op == "==") {
-                // Use index for equality-based searches
-                auto indexedRows = indexIt->indexMap.find(condition.value);
-                if (indexedRows != indexIt->indexMap.end()) {
-                    for (const auto& rowIdx : indexedRows->second) {
-                        result.push_back(rows[rowIdx]);
-                    }
-                }
-                return result;
-            }
-        }
+    // Rows with low <= value <= high in the given column. Served by a B+tree
+    // index on the column when there is one.
+    std::vector<std::vector<std::string>> searchRowsBetween(const std::string& columnName, const std::string& low, const std::string& high,
+                                                            const std::vector<std::string>& projection = {}) {
+        ReadLock lock = readLock();
 
-        // Fall back to regular multi-condition filtering if no index is found or conditions are more complex
-        // (use existing code for multi-condition filtering here)
+        size_t columnIndex = findColumnIndex(columnName);
+        if (columnIndex == static_cast<size_t>(-1)) {
+            std::cout << "Error: Column '" << columnName << "' not found." << std::endl;
+            return {};
+        }
+        std::vector<size_t> outputColumns;
+        if (!projectColumns(projection, outputColumns)) return {};
 
-        return result;
+        PredicatePlan plan;
+        std::vector<size_t> bounds = {compileLeaf(plan, columnIndex, ">=", low), compileLeaf(plan, columnIndex, "<=", high)};
+        plan.root = compileGroup(plan, "AND", bounds);
+        return readMatches(lock, plan, outputColumns);
     }
 
-   void createIndex(const std::string& columnName) {
+   // HASH indexes serve equality lookups; BTREE indexes also serve ranges,
+   // BETWEEN, ORDER BY on the column and MIN/MAX
+   void createIndex(const std::string& columnName, IndexType type = IndexType::HASH) {
+        auto lock = writeLock();
+
         Index newIndex;
         newIndex.column = columnName;
+        newIndex.type = type;
 
         // Find the index of the column to be indexed
         size_t columnIndex = -1;
@@ -1157,81 +5777,109 @@ public:
             return;
         }
 
-        // Populate the index map with column values and row indices
-        for (size_t rowIdx = 0; rowIdx < rows.size(); ++rowIdx) {
-            std::string key = rows[rowIdx][columnIndex];
-            newIndex.indexMap[key].push_back(rowIdx);
-        }
+        buildIndex(newIndex, columnIndex);
 
         // Add newIndex to the list of indexes
-        indexes.push_back(newIndex);
-        std::cout << "Index created on column: " << columnName << std::endl;
+        indexes.push_back(std::move(newIndex));
+        std::cout << "Index created on column: " << columnName << (type == IndexType::BTREE ? " (B+tree)" : "") << std::endl;
     }
 
-    bool isValidDataType(const std::string& value, DataType type){
-        try
-        {
-            if(type == DataType::INTEGER){
-                std::stoi(value); // check if value can converted to an interger
-            } else if (type == DataType::DATE){
-                // Check if value matches date format (e.g., YYYY-MM-DD)
-                std::regex datePattern("\\d{4}-\\d{2}-\\d{2}");
-                return std::regex_match(value, datePattern);
-            }
+    // INTEGER cells need a leading int (as std::stoi reads it) and DATE
+    // cells a real calendar date written YYYY-MM-DD. Cells that pass but
+    // are not canonical (e.g. "85.5") are kept, and Column stores them as
+    // text. Nothing is allocated and nothing throws.
+    static bool isValidDataType(std::string_view value, DataType type){
+        if(type == DataType::INTEGER){
+            int number;
+            return parseLeadingInteger(value, number);
         }
-        catch(...)
-        {
-            return false;
+        if(type == DataType::DATE){
+            int64_t days;
+            return parseCanonicalDate(value, days);
         }
         return true;
-        
     }
 
    // transaction methods
     void beginTransaction(){
-        transactions.emplace_back();
+        {
+            std::lock_guard<std::mutex> lock(transactionMutex);
+            transactions.emplace_back();
+        }
         std::cout << "Transaction started." << std::endl;
     };
 
     void commitTransaction() {
-        if (transactions.empty()){
-            std::cout << "No active transaction to commit." << std::endl;
-            return;
+        Transaction txn;
+        {
+            std::lock_guard<std::mutex> lock(transactionMutex);
+            if (transactions.empty()){
+                std::cout << "No active transaction to commit." << std::endl;
+                return;
+            }
+            txn = std::move(transactions.back());
+            transactions.pop_back();
         }
+        commitTransaction(txn);
+    }
 
-        Transaction& txn = transactions.back();
+    // Apply a transaction built by the caller as one log record. Several
+    // threads may commit at once; the table is locked only while applying,
+    // so their waits for the log overlap and share one flush.
+    void commitTransaction(const Transaction& txn) {
+        if (txn.inserts.empty() && txn.deletes.empty() && commitInPartitions(txn)) return;
 
-        // Apply inserts
-        for(const auto& row : txn.inserts){
-            rows.push_back(row);
-        }
+        uint64_t logPosition;
+        {
+            auto lock = writeLock();
+
+            // Apply inserts
+            for(const auto& row : txn.inserts){
+                if(row.size() == columns.size()){
+                    appendRowData(row);
+                } else {
+                    std::cout << "Warning: Row has incorrect number of columns and will be skipped." << std::endl;
+                }
+            }
 
-        // Apply udpates
-        for(const auto& [index, newData] : txn.updates) {
-            rows[index] = newData;
-        }
+            // Apply udpates
+            for(const auto& [index, newData] : txn.updates) {
+                if (index < rowCount) setRowData(index, newData);
+            }
 
-        // Apply deleted
-        for(auto it = txn.deletes.rbegin(); it != txn.deletes.rend(); ++it){
-            rows.erase(rows.begin() + *it);
+            // Apply deleted
+            std::vector<size_t> deletes;
+            for (size_t index : txn.deletes) {
+                if (index < rowCount) deletes.push_back(index);
+            }
+            std::sort(deletes.begin(), deletes.end());
+            deletes.erase(std::unique(deletes.begin(), deletes.end()), deletes.end());
+            eraseRowData(deletes);
+
+            logPosition = endLogRecord();
         }
 
-         transactions.pop_back();
-        std::cout << "Transaction committed." << std::endl;
+        if (waitForLog(logPosition)) {
+            std::cout << "Transaction committed." << std::endl;
+        }
     }
 
     void rollbackTransaction() {
-        if (transactions.empty()) {
-            std::cout << "No active transaction to rollback." << std::endl;
-            return;
-        }
+        {
+            std::lock_guard<std::mutex> lock(transactionMutex);
+            if (transactions.empty()) {
+                std::cout << "No active transaction to rollback." << std::endl;
+                return;
+            }
 
-        transactions.back().clear();
-        transactions.pop_back();
+            transactions.back().clear();
+            transactions.pop_back();
+        }
         std::cout << "Transaction rolled back." << std::endl;
     }
 
     void addRowTransaction(const std::vector<std::string>& row){
+        std::lock_guard<std::mutex> lock(transactionMutex);
         if(transactions.empty()){
             std::cout<< "Error: No active transaction. Use addRow for non-transactional insert." << std::endl;
             return;
@@ -1240,11 +5888,13 @@ public:
     }
 
     void updateRowTransaction(size_t rowIndex, const std::vector<std::string>& newData){
+        size_t rows = countRows();
+        std::lock_guard<std::mutex> lock(transactionMutex);
         if (transactions.empty()) {
             std::cout << "Error: No active transaction. Use updateRow for non-transactional update." << std::endl;
             return;
         }
-        if (rowIndex >= rows.size()) {
+        if (rowIndex >= rows) {
             std::cout << "Error: Row index out of range." << std::endl;
             return;
         }
@@ -1252,11 +5902,13 @@ public:
     }
 
     void deleteRowTransaction(size_t rowIndex) {
+        size_t rows = countRows();
+        std::lock_guard<std::mutex> lock(transactionMutex);
         if (transactions.empty()) {
             std::cout << "Error: No active transaction. Use deleteRow for non-transactional delete." << std::endl;
             return;
         }
-        if (rowIndex >= rows.size()) {
+        if (rowIndex >= rows) {
             std::cout << "Error: Row index out of range." << std::endl;
             return;
         }
@@ -1286,67 +5938,122 @@ public:
                 return false;
             }
             size_t columnIndex = std::distance(columns.begin(), it);
-            const std::string& cell = row[columnIndex];
+            return compareText(row[columnIndex], condition.op, condition.value);
+        }
+    }
 
-            try {
-                double cellValue = std::stod(cell);
-                double conditionValue = std::stod(condition.value);
+    std::vector<std::vector<std::string>> searchRowsCondition(const Condition& condition, const std::vector<std::string>& projection = {}) {
+        ReadLock lock = readLock();
+        std::vector<size_t> outputColumns;
+        if (!projectColumns(projection, outputColumns)) return {};
+        return readMatches(lock, compilePredicate(condition), outputColumns);
+    }
 
-                if (condition.op == "==") return cellValue == conditionValue;
-                if (condition.op == "!=") return cellValue != conditionValue;
-                if (condition.op == "<") return cellValue < conditionValue;
-                if (condition.op == ">") return cellValue > conditionValue;
-                if (condition.op == "<=") return cellValue <= conditionValue;
-                if (condition.op == ">=") return cellValue >= conditionValue;
-            } catch (const std::invalid_argument&) {
-                // String comparison
-                if (condition.op == "==") return cell == condition.value;
-                if (condition.op == "!=") return cell != condition.value;
-            }
-        }
-        return false;
+    // Cursors over the rows searchRowsCondition, searchRowMultiple and
+    // filterRows would return, or over every row, handed out in batches.
+    // Rows come back with the projection's columns (all when it is empty).
+    Cursor openCursor(const Condition& condition, const std::vector<std::string>& projection = {}) const {
+        return cursorFor([&] { return compilePredicate(condition); }, projection);
     }
 
-    std::vector<std::vector<std::string>> searchRowsCondition(const Condition& condition) {
-        std::vector<std::vector<std::string>> result;
-        for (const auto& row : rows) {
-            if (evaluateConditionNested(condition, row, columns)) {
-                result.push_back(row);
-            }
-        }
-        return result;
+    Cursor openCursor(const ConditionGroup& group, const std::vector<std::string>& projection = {}) const {
+        return cursorFor([&] { return compilePredicate(group); }, projection);
+    }
+
+    Cursor openCursor(const std::string& columnName, const std::string& op, const std::string& value,
+                      const std::vector<std::string>& projection = {}) const {
+        Condition condition;
+        condition.column = columnName;
+        condition.op = op;
+        condition.value = value;
+        return openCursor(condition, projection);
+    }
+
+    Cursor openCursor(const std::vector<std::string>& projection = {}) const {
+        return cursorFor([this] {
+            PredicatePlan plan;
+            plan.root = addConstantNode(plan, true);
+            return plan;
+        }, projection);
     }
     
-    std::vector<std::vector<std::string>> searchRowsConditionAndOrder(const Condition& condition, const std::vector<OrderBy>& orderByColumns) {
-        std::vector<std::vector<std::string>> filteredRows;
-        for (const auto& row : rows) {
-            if (evaluateConditionNested(condition, row, columns)) {
-                filteredRows.push_back(row);
-            }
+    // Rows matching condition ordered by orderByColumns, skipping the first
+    // offset and returning at most limit. With a limit only the best
+    // offset + limit rows are kept while scanning. Only those rows have
+    // their projected cells read.
+    std::vector<std::vector<std::string>> searchRowsConditionAndOrder(const Condition& condition, const std::vector<OrderBy>& orderByColumns,
+                                                                      size_t limit = NO_LIMIT, size_t offset = 0,
+                                                                      const std::vector<std::string>& projection = {}) {
+        ReadLock lock = readLock();
+        std::vector<size_t> outputColumns;
+        if (!projectColumns(projection, outputColumns)) return {};
+
+        std::vector<size_t> orderIndices;
+        std::vector<bool> ascendingFlags;
+        for (const auto& order : orderByColumns) {
+            size_t colIndex = findColumnIndex(order.column);
+            if (colIndex == static_cast<size_t>(-1)) throw std::runtime_error("Invalid column: " + order.column);
+            orderIndices.push_back(colIndex);
+            ascendingFlags.push_back(order.ascending);
         }
 
-         // Step 2: Sort rows based on orderByColumns
-        std::sort(filteredRows.begin(), filteredRows.end(), 
-            [&](const std::vector<std::string>& a, const std::vector<std::string>& b) {
-                for (const auto& order : orderByColumns) {
-                    auto it = std::find(columns.begin(), columns.end(), order.column);
-                    if (it == columns.end()) throw std::runtime_error("Invalid column: " + order.column);
-
-                    size_t colIndex = std::distance(columns.begin(), it);
+        PredicatePlan plan = compilePredicate(condition);
+        const Index* orderIndex = orderIndices.empty() ? nullptr : findUsableIndex(orderIndices[0], IndexType::BTREE);
+        if (!orderIndex && !isSnapshot) {
+            std::unique_ptr<Table> view = snapshotLocked();
+            lock.unlock();
+            return view->searchRowsConditionAndOrder(condition, orderByColumns, limit, offset, projection);
+        }
 
-                    if (a[colIndex] != b[colIndex]) { // Compare values
-                        if (order.ascending) return a[colIndex] < b[colIndex];
-                        else return a[colIndex] > b[colIndex];
-                    }
+        size_t wanted = (limit == NO_LIMIT || offset > NO_LIMIT - limit) ? NO_LIMIT : offset + limit;
+        std::vector<size_t> positions;
+        if (orderIndex) {
+            // Walk the B+tree in the first ORDER BY column's order and keep
+            // the matching rows; only runs of equal keys still need sorting.
+            // Without a limit every row is wanted and the predicate is
+            // evaluated for the whole table at once; with one, row by row as
+            // the walk reaches it, so at most offset + limit rows and a run
+            // of ties are held.
+            std::vector<size_t> runStarts;
+            auto collect = [&](auto&& accept) {
+                if (orderIndex->typedKeys) {
+                    collectInIndexOrder(orderIndex->typedTree, ascendingFlags[0], accept, wanted, positions, runStarts);
+                } else {
+                    collectInIndexOrder(orderIndex->textTree, ascendingFlags[0], accept, wanted, positions, runStarts);
                 }
-                return false; // Rows are equal
+            };
+            if (wanted == NO_LIMIT) {
+                SelectionBitmap selected = matchingBitmap(plan);
+                collect([&](size_t row) { return selected.test(row); });
+            } else {
+                collect([&](size_t row) { return evaluatePlan(plan, plan.root, row); });
+            }
+
+            std::vector<size_t> restIndices(orderIndices.begin() + 1, orderIndices.end());
+            std::vector<bool> restFlags(ascendingFlags.begin() + 1, ascendingFlags.end());
+            runStarts.push_back(positions.size());
+            for (size_t r = 0; r + 1 < runStarts.size() && runStarts[r] < wanted; ++r) {
+                auto first = positions.begin() + runStarts[r];
+                auto last = positions.begin() + runStarts[r + 1];
+                if (last - first < 2) continue;
+                std::sort(first, last);
+                sortPositions(first, last, restIndices, restFlags);
             }
-        );
+        } else if (wanted != NO_LIMIT) {
+            positions = topPositions(plan, wanted, orderIndices, ascendingFlags);
+        } else {
+            positions = matchingRows(plan);
+            sortPositions(positions.begin(), positions.end(), orderIndices, ascendingFlags);
+        }
 
-        return filteredRows;
+        if (positions.size() > wanted) positions.resize(wanted);
+        positions.erase(positions.begin(), positions.begin() + std::min(offset, positions.size()));
+        return materializeRows(positions, outputColumns);
     }
 
     double aggregate(const std::string& columnName, const std::string& function) const {
+        if (!isSnapshot) return snapshot()->aggregate(columnName, function);
+
         //Find column index
         auto it = std::find(columns.begin(), columns.end(), columnName);
         if(it == columns.end()){
@@ -1355,91 +6062,76 @@ public:
 
         size_t columnIndex  = std::distance(columns.begin(), it);
 
-        // Ensure column contains numeric 
-        std::vector<double> numericValues;
-        for(const auto& row : rows){
-            try
-            {
-                numericValues.push_back(std::stod(row[columnIndex]));
-            }
-            catch(const std::invalid_argument)
-            {
-                continue;
-            }
+        AggregateOp op = parseAggregateOp(function);
+        if (op == AggregateOp::INVALID) {
+            throw std::runtime_error("Unsupported aggregate function: " + function);
         }
 
-        if(numericValues.empty()){
-            throw std::runtime_error("No numeric values found in column '" + columnName + "'.");
+        // A typed INTEGER or DATE column has only numeric cells: MIN, MAX
+        // and COUNT come straight from the block zone maps
+        double low, high;
+        if (typedRange(columnIndex, low, high)) {
+            if (op == AggregateOp::MIN) return low;
+            if (op == AggregateOp::MAX) return high;
+            if (op == AggregateOp::COUNT) return static_cast<double>(rowCount);
         }
 
-        // Compute aggregate
-        if (function == "SUM") {
-            return std::accumulate(numericValues.begin(), numericValues.end(), 0.0);
-        } else if (function == "AVERAGE") {
-            return std::accumulate(numericValues.begin(), numericValues.end(), 0.0) / numericValues.size();
-        } else if (function == "MIN") {
-            return *std::min_element(numericValues.begin(), numericValues.end());
-        } else if (function == "MAX") {
-            return *std::max_element(numericValues.begin(), numericValues.end());
-        } else {
-            throw std::runtime_error("Unsupported aggregate function: " + function);
+        AggregateState state;
+        for(size_t row = 0; row < rowCount; ++row){
+            double value;
+            if (numericCell(columnIndex, row, value)) {
+                state.add(value);
+            }
+        }
+        if (op == AggregateOp::COUNT) return static_cast<double>(state.count);
+
+        double result;
+        if(!state.result(op, result)){
+            throw std::runtime_error("No numeric values found in column '" + columnName + "'.");
         }
+        return result;
     }
 
     std::vector<std::vector<std::string>> groupBy(const std::string& groupColumn, const std::string& aggColumn, const std::string& function) const {
-        // Find column indices
-        auto groupIt = std::find(columns.begin(), columns.end(), groupColumn);
-        auto aggIt = std::find(columns.begin(), columns.end(), aggColumn);
+        if (!isSnapshot) return snapshot()->groupBy(groupColumn, aggColumn, function);
 
-        if (groupIt == columns.end()) {
-            throw std::runtime_error("Group column '" + groupColumn + "' not found.");
-        }
-        if (aggIt == columns.end()) {
-            throw std::runtime_error("Aggregate column '" + aggColumn + "' not found.");
-        }
+        // Groups without a numeric value to aggregate are left out
+        std::vector<std::vector<std::string>> result = groupByAggregates({groupColumn}, {{aggColumn, function}});
+        result.erase(std::remove_if(result.begin() + 1, result.end(),
+                                    [](const std::vector<std::string>& row) { return row[1].empty(); }),
+                     result.end());
+        return result;
+    }
 
-        size_t groupIndex = std::distance(columns.begin(), groupIt);
-        size_t aggIndex = std::distance(columns.begin(), aggIt);
+    // GROUP BY any number of columns with several aggregates, in one pass
+    // over the rows. Returns a header row, then one row per group in order
+    // of first appearance: the group's cells, then each aggregate. COUNT is
+    // the group's row count; the others use the numeric cells only and are
+    // empty when a group has none. No group columns aggregate the whole
+    // table. Throws on unknown columns or functions.
+    std::vector<std::vector<std::string>> groupByAggregates(const std::vector<std::string>& groupColumns,
+                                                           const std::vector<Aggregate>& aggregates) const {
+        if (!isSnapshot) return snapshot()->groupByAggregates(groupColumns, aggregates);
 
-        // Group rows by group columns 
-        std::unordered_map<std::string, std::vector<std::vector<std::string>>> groups;
-        for(const auto& row : rows) {
-            groups[row[groupIndex]].push_back(row);
-        }
+        std::vector<AggregateOp> ops;
+        std::vector<size_t> slots;
+        GroupAggregator aggregator = aggregateGroups(groupColumns, aggregates, ops, slots);
 
-        // Compute aggregate for each group
         std::vector<std::vector<std::string>> result;
-        result.push_back({groupColumn, function + "(" + aggColumn + ")"});
-
-        for(const auto& [key, groupRows] : groups){
-            std::vector<double> numericValues;
-            for(const auto& row : groupRows) {
-                try
-                {
-                    numericValues.push_back(std::stod(row[aggIndex]));
-                }
-                catch(const std::invalid_argument)
-                {
-                    continue;
-                }
-            }
+        result.push_back(groupColumns);
+        for (const auto& aggregate : aggregates) result[0].push_back(aggregate.function + "(" + aggregate.column + ")");
 
-            if (numericValues.empty()) continue;
-
-            double aggResult;
-            if (function == "SUM") {
-                aggResult = std::accumulate(numericValues.begin(), numericValues.end(), 0.0);
-            } else if (function == "AVERAGE") {
-                aggResult = std::accumulate(numericValues.begin(), numericValues.end(), 0.0) / numericValues.size();
-            } else if (function == "MIN") {
-                aggResult = *std::min_element(numericValues.begin(), numericValues.end());
-            } else if (function == "MAX") {
-                aggResult = *std::max_element(numericValues.begin(), numericValues.end());
-            } else {
-                throw std::runtime_error("Unsupported aggregate function: " + function);
+        for (size_t group = 0; group < aggregator.groups(); ++group) {
+            std::vector<std::string> row;
+            row.reserve(groupColumns.size() + aggregates.size());
+            for (size_t k = 0; k < groupColumns.size(); ++k) row.push_back(groupCell(aggregator, group, k));
+            for (size_t i = 0; i < aggregates.size(); ++i) {
+                double value;
+                if (ops[i] == AggregateOp::COUNT) row.push_back(std::to_string(aggregator.rowCounts[group]));
+                else if (aggregator.state(group, slots[i]).result(ops[i], value)) row.push_back(std::to_string(value));
+                else row.emplace_back();
             }
-
-            result.push_back({key, std::to_string(aggResult)});
+            result.push_back(std::move(row));
         }
         return result;
     }